@@ -0,0 +1,266 @@
+/*******************************************************************************************
+ *
+ *  Count the k-mers of a DB in one streaming pass, writing the table of counts to a .kfreq
+ *    file next to the DB (see kfreq.h).  Given such a table, daligner -K suppresses k-mers by
+ *    their frequency in the entire DB, and so identically in every comparison of its blocks.
+ *
+ ********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "DB.h"
+#include "kfreq.h"
+
+static char *Usage = "[-v] [-k<int(14)>] [-T<int(4)>] <source:db|dam>";
+
+#define BATCH  0x10000000ll   //  Bases (and delimiters) read from the DB at a time
+
+static int     Kmer;
+static int     Tbits;
+static uint64  Kmask;
+static uint16 *Table;
+
+static char   *Bases;         //  A batch: reads [0,Nbatch) at Bases+Boff[r]
+static int64  *Boff;
+static int     Nbatch;
+
+typedef struct
+  { int   beg, end;           //  Count the k-mers of batch reads [beg,end)
+    int64 kmers;
+  } Count_Arg;
+
+  //  Increment a counter unless it is saturated, racing with other threads
+
+static inline void bump(uint16 *t)
+{ uint16 v;
+
+  v = *t;
+  while (v < KFREQ_MAX && ! __sync_bool_compare_and_swap(t,v,v+1))
+    v = *t;
+}
+
+static void *count_thread(void *arg)
+{ Count_Arg *data  = (Count_Arg *) arg;
+  int        rsh   = 2*Kmer-2;
+  int64      kmers = 0;
+  uint64     c, r;
+  char      *s;
+  int        i, p, x;
+
+  for (i = data->beg; i < data->end; i++)
+    { s = Bases + Boff[i];
+      c = r = 0;
+      for (p = 0; p < Kmer-1; p++)
+        { if ((x = s[p]) == 4)
+            break;
+          c = (c << 2) | x;
+          r = (r >> 2) | (((uint64) (3-x)) << rsh);
+        }
+      if (p < Kmer-1)
+        continue;
+      while ((x = s[p++]) != 4)
+        { c = ((c << 2) | x) & Kmask;
+          r = (r >> 2) | (((uint64) (3-x)) << rsh);
+          bump(Table + Kfreq_Slot(c,r,Kmer,Tbits));
+          kmers += 1;
+        }
+    }
+
+  data->kmers = kmers;
+  return (NULL);
+}
+
+int main(int argc, char *argv[])
+{ DAZZ_DB      _db, *db = &_db;
+  Kfreq_Header hdr;
+  char        *name, *temp;
+  FILE        *out;
+  int64        nkmers, nslots, used, full;
+  int          NTHREADS;
+  int          VERBOSE;
+
+  //  Process arguments
+
+  { int i, j, k;
+    int flags[128];
+    char *eptr;
+
+    ARG_INIT("DBkcount")
+
+    Kmer     = 14;
+    NTHREADS = 4;
+
+    j = 1;
+    for (i = 1; i < argc; i++)
+      if (argv[i][0] == '-')
+        switch (argv[i][1])
+        { default:
+            ARG_FLAGS("v")
+            break;
+          case 'k':
+            ARG_POSITIVE(Kmer,"K-mer length")
+            if (Kmer > 32)
+              { fprintf(stderr,"%s: K-mer length must be 32 or less\n",Prog_Name);
+                exit (1);
+              }
+            break;
+          case 'T':
+            ARG_POSITIVE(NTHREADS,"Number of threads")
+            break;
+        }
+      else
+        argv[j++] = argv[i];
+    argc = j;
+
+    VERBOSE = flags['v'];
+
+    if (argc != 2)
+      { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage);
+        fprintf(stderr,"\n");
+        fprintf(stderr,"      -k: k-mer size (must be <= 32, use that of daligner).\n");
+        fprintf(stderr,"      -T: Use -T threads.\n");
+        fprintf(stderr,"      -v: Verbose mode, output statistics as proceed.\n");
+        exit (1);
+      }
+  }
+
+  //  Open and trim the DB, all of it as daligner sees it in its blocks
+
+  if (Open_DB(argv[1],db) < 0)
+    exit (1);
+  if (db->part > 0)
+    { fprintf(stderr,"%s: Cannot be called on a block: %s\n",Prog_Name,argv[1]);
+      exit (1);
+    }
+  Trim_DB(db);
+
+  Tbits  = Kfreq_Bits(Kmer);
+  nslots = (1ll << Tbits);
+  Kmask  = (Kmer == 32) ? 0xffffffffffffffffllu : (1llu << 2*Kmer) - 1;
+
+  Table = (uint16 *) Malloc(sizeof(uint16)*nslots,"Allocating count table");
+  Bases = (char *) Malloc(BATCH + 2*db->maxlen + 4,"Allocating read buffer");
+  Boff  = (int64 *) Malloc(sizeof(int64)*(db->nreads+1),"Allocating read buffer");
+  if (Table == NULL || Bases == NULL || Boff == NULL)
+    exit (1);
+  memset(Table,0,sizeof(uint16)*nslots);
+
+  if (VERBOSE)
+    { printf("\n  Counting the %d-mers of ",Kmer);
+      Print_Number((int64) db->nreads,0,stdout);
+      printf(" reads (");
+      Print_Number(db->totlen,0,stdout);
+      printf(" bp) into 2^%d slots\n",Tbits);
+      fflush(stdout);
+    }
+
+  //  Load the reads a batch at a time and count the batch in parallel, each thread taking
+  //    an equal share of its bases
+
+  { pthread_t threads[NTHREADS];
+    Count_Arg parmc[NTHREADS];
+    int64     boff, x;
+    int       i, r, f;
+
+    nkmers = 0;
+    for (f = 0; f < db->nreads; f += Nbatch)
+      { boff = 0;
+        for (r = f; r < db->nreads && (boff < BATCH || r == f); r++)
+          { Boff[r-f] = boff+1;
+            Load_Read(db,r,Bases+(boff+1),0);
+            boff += db->reads[r].rlen + 2;
+          }
+        Nbatch = r-f;
+        Boff[Nbatch] = boff+1;
+
+        parmc[0].beg = 0;
+        r = 0;
+        for (i = 1; i < NTHREADS; i++)
+          { x = (boff*i)/NTHREADS;
+            while (r < Nbatch && Boff[r] < x)
+              r += 1;
+            parmc[i-1].end = parmc[i].beg = r;
+          }
+        parmc[NTHREADS-1].end = Nbatch;
+
+        for (i = 0; i < NTHREADS; i++)
+          pthread_create(threads+i,NULL,count_thread,parmc+i);
+
+        for (i = 0; i < NTHREADS; i++)
+          { pthread_join(threads[i],NULL);
+            nkmers += parmc[i].kmers;
+          }
+      }
+  }
+
+  if (VERBOSE)
+    { int64 i;
+
+      used = full = 0;
+      for (i = 0; i < nslots; i++)
+        if (Table[i] > 0)
+          { used += 1;
+            if (Table[i] == KFREQ_MAX)
+              full += 1;
+          }
+      printf("  ");
+      Print_Number(nkmers,0,stdout);
+      printf(" k-mers in ");
+      Print_Number(used,0,stdout);
+      printf(" slots, ");
+      Print_Number(full,0,stdout);
+      printf(" of them saturated\n");
+      fflush(stdout);
+    }
+
+  //  Write the table to a temporary file and rename it so that no daligner job sees it half
+  //    written
+
+  memset(&hdr,0,sizeof(Kfreq_Header));
+  memcpy(hdr.magic,KFREQ_MAGIC,8);
+  hdr.version = KFREQ_VERSION;
+  hdr.kmer    = Kmer;
+  hdr.tbits   = Tbits;
+  hdr.nreads  = db->nreads;
+  hdr.totlen  = db->totlen;
+  hdr.nkmers  = nkmers;
+
+  name = Strdup(KFREQ_NAME(db->path),"Allocating table file name");
+  temp = (char *) Malloc(strlen(name)+30,"Allocating table file name");
+  if (name == NULL || temp == NULL)
+    exit (1);
+  sprintf(temp,"%s.%d",name,getpid());
+
+  out = Fopen(temp,"w");
+  if (out == NULL)
+    exit (1);
+  if (fwrite(&hdr,sizeof(Kfreq_Header),1,out) != 1 ||
+      fwrite(Table,sizeof(uint16),nslots,out) != (size_t) nslots || fclose(out) != 0)
+    { fprintf(stderr,"%s: Could not write %s\n",Prog_Name,temp);
+      unlink(temp);
+      exit (1);
+    }
+  if (rename(temp,name) != 0)
+    { fprintf(stderr,"%s: Could not rename %s to %s\n",Prog_Name,temp,name);
+      unlink(temp);
+      exit (1);
+    }
+
+  if (VERBOSE)
+    { printf("  Wrote %s\n",name);
+      fflush(stdout);
+    }
+
+  free(temp);
+  free(name);
+  free(Boff);
+  free(Bases);
+  free(Table);
+  Close_DB(db);
+
+  exit (0);
+}
@@ -24,7 +24,7 @@
 #undef  SLURM  //  define if want a directly executable SLURM script
 
 static char *Usage[] =
-  { "[-vbad] [-t<int>] [-w<int(6)>] [-l<int(1000)>] [-s<int(100)] [-M<int>]",
+  { "[-vbadX] [-t<int>] [-K<int>] [-w<int(6)>] [-l<int(1000)>] [-s<int(100)] [-M<int>]",
     "        [-P<dir(/tmp)>] [-B<int(4)>] [-T<int(4)>] [-f<name>]",
     "      ( [-k<int(14)>] [-h<int(35)>] [-e<double(.70)>] [-H<int>]",
     "        [-k<int(20)>] [-h<int(50)>] [-e<double(.85)>] <ref:db|dam> )",
@@ -34,8 +34,8 @@ static char *Usage[] =
   //  Command Options
 
 static int    BUNIT;
-static int    VON, BON, CON, DON;
-static int    WINT, TINT, HGAP, HINT, KINT, SINT, LINT, MINT;
+static int    VON, BON, CON, DON, XON;
+static int    WINT, TINT, HGAP, HINT, KINT, SINT, LINT, MINT, FINT;
 static int    NTHREADS;
 static double EREL;
 static int    MMAX, MTOP;
@@ -69,6 +69,22 @@ static char  *PDIR;
 
 #endif
 
+  //  Output a DBkcount command building the .kfreq table of a DB that daligner -K needs
+
+static void kcount_command(FILE *out, int usepath, char *pwd, char *root)
+{ fprintf(out,"DBkcount");
+  if (VON)
+    fprintf(out," -v");
+  if (KINT != 14)
+    fprintf(out," -k%d",KINT);
+  if (NTHREADS != 4)
+    fprintf(out," -T%d",NTHREADS);
+  if (usepath)
+    fprintf(out," %s/%s\n",pwd,root);
+  else
+    fprintf(out," %s\n",root);
+}
+
 void daligner_script(int argc, char *argv[])
 { int   nblocks;
   int   usepath;
@@ -209,6 +225,21 @@ void daligner_script(int argc, char *argv[])
           fclose(out);
       }
 
+    //  Count the k-mers of the DB if FINT
+
+    if (FINT > 0)
+      { if (ONAME != NULL)
+          { sprintf(name,"%s.00.KFREQ",ONAME);
+            out = fopen(name,"w");
+          }
+
+        fprintf(out,"# Count k-mers for -K\n");
+        kcount_command(out,usepath,pwd,root);
+
+        if (ONAME != NULL)
+          fclose(out);
+      }
+
     //  Produce all necessary daligner jobs
 
     if (ONAME != NULL)
@@ -251,6 +282,8 @@ void daligner_script(int argc, char *argv[])
               fprintf(out," -b");
             if (CON)
               fprintf(out," -a");
+            if (XON)
+              fprintf(out," -X");
             if (KINT != 14)
               fprintf(out," -k%d",KINT);
             if (WINT != 6)
@@ -259,6 +292,8 @@ void daligner_script(int argc, char *argv[])
               fprintf(out," -h%d",HINT);
             if (TINT > 0)
               fprintf(out," -t%d",TINT);
+            if (FINT > 0)
+              fprintf(out," -K%d",FINT);
             if (HGAP > 0)
               fprintf(out," -H%d",HGAP);
             if (EREL > 0.)
@@ -729,6 +764,22 @@ void mapper_script(int argc, char *argv[])
           fclose(out);
       }
 
+    //  Count the k-mers of both DBs if FINT
+
+    if (FINT > 0)
+      { if (ONAME != NULL)
+          { sprintf(name,"%s.00.KFREQ",ONAME);
+            out = fopen(name,"w");
+          }
+
+        fprintf(out,"# Count k-mers for -K\n");
+        kcount_command(out,usepath1,pwd1,root1);
+        kcount_command(out,usepath2,pwd2,root2);
+
+        if (ONAME != NULL)
+          fclose(out);
+      }
+
     //  Produce all necessary daligner jobs ...
 
     if (ONAME != NULL)
@@ -770,12 +821,16 @@ void mapper_script(int argc, char *argv[])
               fprintf(out," -b");
             if (CON)
               fprintf(out," -a");
+            if (XON)
+              fprintf(out," -X");
             fprintf(out," -k%d",KINT);
             if (WINT != 6)
               fprintf(out," -w%d",WINT);
             fprintf(out," -h%d",HINT);
             if (TINT > 0)
               fprintf(out," -t%d",TINT);
+            if (FINT > 0)
+              fprintf(out," -K%d",FINT);
             if (EREL > 0.)
               fprintf(out," -e%g",EREL);
             else
@@ -988,6 +1043,7 @@ int main(int argc, char *argv[])
 
   BUNIT = 4;
   TINT  = 0;
+  FINT  = 0;
   WINT  = 6;
   LINT  = 1000;
   SINT  = 100;
@@ -1008,7 +1064,7 @@ int main(int argc, char *argv[])
     if (argv[i][0] == '-')
       switch (argv[i][1])
       { default:
-          ARG_FLAGS("vbadAI");
+          ARG_FLAGS("vbadAIX");
           break;
         case 'e':
           ARG_REAL(EREL)
@@ -1057,6 +1113,9 @@ int main(int argc, char *argv[])
         case 'H':
           ARG_POSITIVE(HGAP,"HGAP threshold (in bp.s)")
           break;
+        case 'K':
+          ARG_POSITIVE(FINT,"DB-wide tuple suppression frequency")
+          break;
         case 'M':
           ARG_NON_NEGATIVE(MINT,"Memory allocation (in Gb)")
           break;
@@ -1075,6 +1134,7 @@ int main(int argc, char *argv[])
   BON = flags['b'];
   CON = flags['a'];
   DON = flags['d'];
+  XON = flags['X'];
 
   if (argc < 2 || argc > 4)
     { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage[0]);
@@ -1089,6 +1149,7 @@ int main(int argc, char *argv[])
       fprintf(stderr,"      -h: A seed hit if the k-mers in band cover >= -h bps in the");
       fprintf(stderr," targest read.\n");
       fprintf(stderr,"      -t: Ignore k-mers that occur >= -t times in a block.\n");
+      fprintf(stderr,"      -K: Ignore k-mers that occur >= -K times in the DB (runs DBkcount).\n");
       fprintf(stderr,"      -M: Use only -M GB of memory by ignoring most frequent k-mers.\n");
       fprintf(stderr,"\n");
       fprintf(stderr,"      -e: Look for alignments with -e percent similarity.\n");
@@ -1100,6 +1161,7 @@ int main(int argc, char *argv[])
       fprintf(stderr,"      -P: Do first level sort and merge in directory -P.\n");
       fprintf(stderr,"      -m: Soft mask the blocks with the specified mask.\n");
       fprintf(stderr,"      -b: For AT/GC biased data, compensate k-mer counts (deprecated).\n");
+      fprintf(stderr,"      -X: Reuse block k-mer indices saved in .kidx files.\n");
       fprintf(stderr,"\n");
       fprintf(stderr,"     Script control.\n");
       fprintf(stderr,"      -v: Run all commands in script in verbose mode.\n");
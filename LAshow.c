@@ -22,7 +22,7 @@
 #include "align.h"
 
 static char *Usage[] =
-    { "[-caroUF] [-i<int(4)>] [-w<int(100)>] [-b<int(10)>] ",
+    { "[-caroUF] [-i<int(4)>] [-w<int(100)>] [-b<int(10)>] [-T<int(1)>]",
       "    <src1:db|dam> [ <src2:db|dam> ] <align:las> [ <reads:FILE> | <reads:range> ... ]"
     };
 
@@ -49,6 +49,7 @@ int main(int argc, char *argv[])
   int     FLIP, MAP;
   int     INDENT, WIDTH, BORDER, UPPERCASE;
   int     ISTWO;
+  int     NTHREADS;
 
   //  Process options
 
@@ -61,6 +62,7 @@ int main(int argc, char *argv[])
     INDENT    = 4;
     WIDTH     = 100;
     BORDER    = 10;
+    NTHREADS  = 1;
 
     j = 1;
     for (i = 1; i < argc; i++)
@@ -78,6 +80,9 @@ int main(int argc, char *argv[])
           case 'b':
             ARG_NON_NEGATIVE(BORDER,"Alignment border")
             break;
+          case 'T':
+            ARG_POSITIVE(NTHREADS,"Number of threads")
+            break;
         }
       else
         argv[j++] = argv[i];
@@ -105,6 +110,7 @@ int main(int argc, char *argv[])
         fprintf(stderr,"      -i: Indent alignments and cartoons by -i.\n");
         fprintf(stderr,"      -w: Width of each row of alignment in symbols (-a) or bps (-r).\n");
         fprintf(stderr,"      -b: # of border bp.s to show on each side of LA.\n");
+        fprintf(stderr,"      -T: Use -T threads to compute the alignment of a long LA.\n");
         exit (1);
       }
   }
@@ -322,7 +328,7 @@ int main(int argc, char *argv[])
   
   { int        j;
     uint16    *trace;
-    Work_Data *work;
+    Work_Data *work, **works;
     int        tmax;
     int        in, npt, idx, ar;
     int64      tps;
@@ -336,14 +342,20 @@ int main(int argc, char *argv[])
 
     aln->path = &(ovl->path);
     if (ALIGN || REFERENCE)
-      { work = New_Work_Data();
+      { works = (Work_Data **) Malloc(sizeof(Work_Data *)*NTHREADS,"Allocating work data");
+        if (works == NULL)
+          exit (1);
+        for (j = 0; j < NTHREADS; j++)
+          works[j] = New_Work_Data();
+        work = works[0];
         abuffer = New_Read_Buffer(db1);
         bbuffer = New_Read_Buffer(db2);
       }
     else
       { abuffer = NULL;
         bbuffer = NULL;
-        work = NULL;
+        work  = NULL;
+        works = NULL;
       }
 
     tmax  = 1000;
@@ -620,7 +632,7 @@ int main(int argc, char *argv[])
                 if (tspace == 0)
                   Compute_Trace_IRR(aln,work,GREEDIEST);
                 else
-                  Compute_Trace_PTS(aln,work,tspace,GREEDIEST);
+                  Compute_Trace_PTS_MT(aln,works,NTHREADS,tspace,GREEDIEST);
 
                 if (FLIP)
                   { if (COMP(aln->flags))
@@ -645,7 +657,9 @@ int main(int argc, char *argv[])
     if (ALIGN)
       { free(bbuffer-1);
         free(abuffer-1);
-        Free_Work_Data(work);
+        for (j = 0; j < NTHREADS; j++)
+          Free_Work_Data(works[j]);
+        free(works);
       }
   }
 
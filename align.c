@@ -20,6 +20,7 @@
 #include <unistd.h>
 #include <math.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "DB.h"
 #include "align.h"
@@ -42,6 +43,14 @@
 
 #undef  WAVE_STATS
 
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(NO_SIMD)
+#define WAVE_SIMD          //  Advance the waves of Local_Alignment 8 diagonals at a time with
+#endif                     //    AVX2 if the CPU has it (compile with -DNO_SIMD to disable)
+
+#ifdef WAVE_SIMD
+#include <immintrin.h>
+#endif
+
 
 /****************************************************************************************\
 *                                                                                        *
@@ -167,6 +176,7 @@ typedef struct
     int    ave_path;
     int16 *score;
     int16 *table;
+    int    simd;        //  Use the AVX2 wave kernel (see wave_lanes)
   } _Align_Spec;
  
 /* Fill in bit table: TABLE[x] = 1 iff the alignment modeled by x (1 = match, 0 = mismatch)
@@ -242,6 +252,13 @@ Align_Spec *New_Align_Spec(double ave_corr, int trace_space, float *freq, int re
   spec->table = parms.table;
   spec->score = parms.score;
 
+#ifdef WAVE_SIMD
+  __builtin_cpu_init();
+  spec->simd = __builtin_cpu_supports("avx2");
+#else
+  spec->simd = 0;
+#endif
+
   return ((Align_Spec *) spec);
 }
 
@@ -327,6 +344,222 @@ typedef struct
 
 static int VectorEl = 6*sizeof(int) + sizeof(BVEC);
 
+#ifdef WAVE_SIMD
+
+/* The AVX2 wave kernel: for the 8 diagonals kb..kb+7 of the next wave, select the furthest
+   reaching predecessor of each diagonal and slide each along its run of matches, all 8 at
+   once, leaving the pebble and best point bookkeeping to the scalar loop that consumes the
+   lanes in its usual order.  The values of the diagonal processed just before the block
+   (kb+8 in a forward wave, kb-1 in a reverse wave) have already been overwritten, so its
+   prior values are passed in pv, pm, pt, pha, and phb.  The slide reads the sequences a
+   4-byte word at a time, so both must have 3 addressable bytes after their terminating 4
+   (see Local_Alignment in align.h).  The result is exactly that of the scalar loop. */
+
+typedef struct
+  { int  y[8];       //  The slide on diagonal kb+i ends at B-position y[i]
+    int  m[8];       //  with match count m[i], path bits b[i], and A and B pebble
+    int  ha[8];      //    chains ha[i] and hb[i]
+    int  hb[8];
+    BVEC b[8];
+    int  aend;       //  Bit i is set if the slide on kb+i ended at the end of A
+    int  bend;       //  Bit i is set if the slide on kb+i ended at the end of B
+  } Wave_Lanes;
+
+static __attribute__((target("avx2"))) __m256i popcount64(__m256i v)
+{ __m256i lut  = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                  0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+  __m256i nib  = _mm256_set1_epi8(0x0f);
+  __m256i cnt;
+
+  cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut,_mm256_and_si256(v,nib)),
+                        _mm256_shuffle_epi8(lut,_mm256_and_si256(_mm256_srli_epi16(v,4),nib)));
+  return (_mm256_sad_epu8(cnt,_mm256_setzero_si256()));
+}
+
+  //  Update the path bits b (already shifted for the wave) and return the change in the
+  //    match count for slides of length len (< 2^31), as the scalar loop does a step at a time
+
+static __attribute__((target("avx2"))) __m256i slide_bits(__m256i *b, __m256i len)
+{ __m256i one = _mm256_set1_epi64x(1);
+  __m256i lc, w, z;
+
+  lc = _mm256_min_epi32(len,_mm256_set1_epi64x(PATH_LEN+1));
+  w  = _mm256_sub_epi64(_mm256_slli_epi64(one,PATH_LEN+1),
+                        _mm256_sllv_epi64(one,_mm256_sub_epi64(_mm256_set1_epi64x(PATH_LEN+1),lc)));
+  z  = _mm256_sub_epi64(lc,popcount64(_mm256_and_si256(*b,w)));
+  *b = _mm256_or_si256(_mm256_sllv_epi64(*b,len),_mm256_sub_epi64(_mm256_sllv_epi64(one,len),one));
+  return (z);
+}
+
+static __attribute__((target("avx2")))
+void wave_lanes(Wave_Lanes *ln, int kb, int fwd, char *aseq, char *bseq,
+                int *V, int *M, int *HA, int *HB, BVEC *T,
+                int pv, int pm, BVEC pt, int pha, int phb)
+{ __m256i k, vc, vn, vp, mc, mn, mp;
+  __m256i hac, han, hap, hbc, hbn, hbp;
+  __m256i tcl, tch, tnl, tnh, tpl, tph;
+  __m256i seln, selp, nl, nh, pl, ph;
+  __m256i c, m, ha, hb, bl, bh, s;
+  __m256i y, y0, act, stop, bw, aw, b4, a4, ok, n, aend, bend;
+  __m256i one, four, swap, even;
+  int     d;
+
+  d = (fwd ? -1 : 1);     //  Offset of the neighbor not yet overwritten
+
+  k  = _mm256_add_epi32(_mm256_set1_epi32(kb),_mm256_setr_epi32(0,1,2,3,4,5,6,7));
+
+  vc  = _mm256_loadu_si256((__m256i *) (V+kb));
+  vn  = _mm256_loadu_si256((__m256i *) (V+(kb+d)));
+  vp  = _mm256_loadu_si256((__m256i *) (V+(kb-d)));
+  mc  = _mm256_loadu_si256((__m256i *) (M+kb));
+  mn  = _mm256_loadu_si256((__m256i *) (M+(kb+d)));
+  mp  = _mm256_loadu_si256((__m256i *) (M+(kb-d)));
+  hac = _mm256_loadu_si256((__m256i *) (HA+kb));
+  han = _mm256_loadu_si256((__m256i *) (HA+(kb+d)));
+  hap = _mm256_loadu_si256((__m256i *) (HA+(kb-d)));
+  hbc = _mm256_loadu_si256((__m256i *) (HB+kb));
+  hbn = _mm256_loadu_si256((__m256i *) (HB+(kb+d)));
+  hbp = _mm256_loadu_si256((__m256i *) (HB+(kb-d)));
+  tcl = _mm256_loadu_si256((__m256i *) (T+kb));
+  tch = _mm256_loadu_si256((__m256i *) (T+(kb+4)));
+  tnl = _mm256_loadu_si256((__m256i *) (T+(kb+d)));
+  tnh = _mm256_loadu_si256((__m256i *) (T+(kb+4+d)));
+  tpl = _mm256_loadu_si256((__m256i *) (T+(kb-d)));
+  tph = _mm256_loadu_si256((__m256i *) (T+(kb+4-d)));
+
+  //  Select as the scalar loop does, a forward wave maximizing and a reverse wave minimizing
+
+  if (fwd)
+    { vp  = _mm256_insert_epi32(vp,pv,7);
+      mp  = _mm256_insert_epi32(mp,pm,7);
+      hap = _mm256_insert_epi32(hap,pha,7);
+      hbp = _mm256_insert_epi32(hbp,phb,7);
+      tph = _mm256_insert_epi64(tph,(int64) pt,3);
+
+      s    = _mm256_cmpgt_epi32(vn,vc);
+      selp = _mm256_blendv_epi8(_mm256_cmpgt_epi32(vp,vc),_mm256_cmpgt_epi32(vp,vn),s);
+      seln = _mm256_andnot_si256(selp,s);
+
+      c = _mm256_add_epi32(vc,_mm256_set1_epi32(2));
+      c = _mm256_blendv_epi8(c,_mm256_add_epi32(vn,_mm256_set1_epi32(1)),seln);
+      c = _mm256_blendv_epi8(c,_mm256_add_epi32(vp,_mm256_set1_epi32(1)),selp);
+    }
+  else
+    { vp  = _mm256_insert_epi32(vp,pv,0);
+      mp  = _mm256_insert_epi32(mp,pm,0);
+      hap = _mm256_insert_epi32(hap,pha,0);
+      hbp = _mm256_insert_epi32(hbp,phb,0);
+      tpl = _mm256_insert_epi64(tpl,(int64) pt,0);
+
+      s    = _mm256_cmpgt_epi32(vc,vn);
+      selp = _mm256_blendv_epi8(_mm256_cmpgt_epi32(vc,vp),_mm256_cmpgt_epi32(vn,vp),s);
+      seln = _mm256_andnot_si256(selp,s);
+
+      c = _mm256_sub_epi32(vc,_mm256_set1_epi32(2));
+      c = _mm256_blendv_epi8(c,_mm256_sub_epi32(vn,_mm256_set1_epi32(1)),seln);
+      c = _mm256_blendv_epi8(c,_mm256_sub_epi32(vp,_mm256_set1_epi32(1)),selp);
+    }
+
+  m  = _mm256_blendv_epi8(_mm256_blendv_epi8(mc,mn,seln),mp,selp);
+  ha = _mm256_blendv_epi8(_mm256_blendv_epi8(hac,han,seln),hap,selp);
+  hb = _mm256_blendv_epi8(_mm256_blendv_epi8(hbc,hbn,seln),hbp,selp);
+
+  nl = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(seln));
+  nh = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(seln,1));
+  pl = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(selp));
+  ph = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(selp,1));
+  bl = _mm256_blendv_epi8(_mm256_blendv_epi8(tcl,tnl,nl),tpl,pl);
+  bh = _mm256_blendv_epi8(_mm256_blendv_epi8(tch,tnh,nh),tph,ph);
+
+  //  Slide all 8 diagonals until each has hit a mismatch or the end of a sequence, 4
+  //    positions at a time.  In a reverse wave the word ending at a position is loaded
+  //    (from no further back than the 4 that precedes a sequence) and its bytes reversed
+  //    and shifted so that in either direction byte j of a word is the j'th position ahead.
+
+  one  = _mm256_set1_epi32(1);
+  four = _mm256_set1_epi8(4);
+  swap = _mm256_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,
+                          3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+
+  y    = _mm256_srai_epi32(_mm256_sub_epi32(c,k),1);
+  y0   = y;
+  act  = _mm256_set1_epi32(-1);
+  aend = bend = _mm256_setzero_si256();
+  do
+    { if (fwd)
+        { bw = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),(int const *) bseq,y,act,1);
+          aw = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),(int const *) aseq,
+                                           _mm256_add_epi32(y,k),act,1);
+        }
+      else
+        { __m256i ia, sa, sb;
+
+          ia = _mm256_add_epi32(y,k);
+          sb = _mm256_max_epi32(_mm256_sub_epi32(y,_mm256_set1_epi32(3)),_mm256_setzero_si256());
+          sa = _mm256_max_epi32(_mm256_sub_epi32(ia,_mm256_set1_epi32(3)),_mm256_setzero_si256());
+          bw = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),(int const *) bseq,sb,act,1);
+          aw = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),(int const *) aseq,sa,act,1);
+          bw = _mm256_srlv_epi32(_mm256_shuffle_epi8(bw,swap),
+                 _mm256_slli_epi32(_mm256_sub_epi32(_mm256_set1_epi32(3),_mm256_sub_epi32(y,sb)),3));
+          aw = _mm256_srlv_epi32(_mm256_shuffle_epi8(aw,swap),
+                 _mm256_slli_epi32(_mm256_sub_epi32(_mm256_set1_epi32(3),_mm256_sub_epi32(ia,sa)),3));
+        }
+
+      b4 = _mm256_cmpeq_epi8(bw,four);
+      a4 = _mm256_cmpeq_epi8(aw,four);
+      ok = _mm256_andnot_si256(b4,_mm256_cmpeq_epi8(bw,aw));
+
+      n   = _mm256_and_si256(ok,one);                        //  n = # of leading bytes ok
+      s   = _mm256_and_si256(n,_mm256_srli_epi32(ok,8));
+      n   = _mm256_add_epi32(n,s);
+      s   = _mm256_and_si256(s,_mm256_srli_epi32(ok,16));
+      n   = _mm256_add_epi32(n,s);
+      s   = _mm256_and_si256(s,_mm256_srli_epi32(ok,24));
+      n   = _mm256_and_si256(_mm256_add_epi32(n,s),act);
+
+      stop = _mm256_and_si256(act,_mm256_cmpgt_epi32(_mm256_set1_epi32(4),n));
+      s    = _mm256_slli_epi32(n,3);
+      b4   = _mm256_and_si256(_mm256_srlv_epi32(b4,s),one);
+      a4   = _mm256_and_si256(_mm256_srlv_epi32(a4,s),one);
+      bend = _mm256_or_si256(bend,_mm256_and_si256(stop,_mm256_cmpeq_epi32(b4,one)));
+      aend = _mm256_or_si256(aend,_mm256_and_si256(stop,
+                                    _mm256_cmpeq_epi32(_mm256_andnot_si256(b4,a4),one)));
+      act  = _mm256_andnot_si256(stop,act);
+      if (fwd)
+        y = _mm256_add_epi32(y,n);
+      else
+        y = _mm256_sub_epi32(y,n);
+    }
+  while ( ! _mm256_testz_si256(act,act));
+
+  //  Shift the path bits and count the matches of the slide, in 64-bit halves
+
+  s  = (fwd ? _mm256_sub_epi32(y,y0) : _mm256_sub_epi32(y0,y));
+  one = _mm256_set1_epi64x(1);
+  nl  = _mm256_sub_epi64(_mm256_setzero_si256(),_mm256_and_si256(_mm256_srli_epi64(bl,PATH_LEN),one));
+  nh  = _mm256_sub_epi64(_mm256_setzero_si256(),_mm256_and_si256(_mm256_srli_epi64(bh,PATH_LEN),one));
+  bl = _mm256_slli_epi64(bl,1);
+  bh = _mm256_slli_epi64(bh,1);
+  nl = _mm256_add_epi64(nl,slide_bits(&bl,_mm256_cvtepi32_epi64(_mm256_castsi256_si128(s))));
+  nh = _mm256_add_epi64(nh,slide_bits(&bh,_mm256_cvtepi32_epi64(_mm256_extracti128_si256(s,1))));
+
+  even = _mm256_setr_epi32(0,2,4,6,1,3,5,7);
+  nl   = _mm256_permute2x128_si256(_mm256_permutevar8x32_epi32(nl,even),
+                                   _mm256_permutevar8x32_epi32(nh,even),0x20);
+  m    = _mm256_add_epi32(m,nl);
+
+  _mm256_storeu_si256((__m256i *) ln->y,y);
+  _mm256_storeu_si256((__m256i *) ln->m,m);
+  _mm256_storeu_si256((__m256i *) ln->ha,ha);
+  _mm256_storeu_si256((__m256i *) ln->hb,hb);
+  _mm256_storeu_si256((__m256i *) ln->b,bl);
+  _mm256_storeu_si256((__m256i *) (ln->b+4),bh);
+  ln->aend = _mm256_movemask_ps(_mm256_castsi256_ps(aend));
+  ln->bend = _mm256_movemask_ps(_mm256_castsi256_ps(bend));
+}
+
+#endif
+
 static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, Path *bpath,
                         int *mind, int maxd, int mida, int minp, int maxp, int aoff, int boff)
 { char *aseq  = align->aseq;
@@ -572,6 +805,10 @@ static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
       BVEC    t;
       int     am, ac, ap;
       char   *a;
+#ifdef WAVE_SIMD
+      int        kb;
+      Wave_Lanes lane;
+#endif
 
       low -= 1;
       hgh += 1;
@@ -675,6 +912,9 @@ static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
       t  = PATH_INT;
       n  = PATH_LEN;
       ua = ub = -1;
+#ifdef WAVE_SIMD
+      kb = hgh+1;
+#endif
       for (k = hgh; k >= low; k--)
         { int     y, m;
           int     ha, hb;
@@ -686,62 +926,87 @@ static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
           ac = am;
           am = V[d = k-1];
 
-          if (ac < am)
-            if (am < ap)
-              { c  = ap+1;
-                m  = n;
-                b  = t;
-                ha = ua;
-                hb = ub;
-              }
-            else
-              { c  = am+1;
-                m  = M[d];
-                b  = T[d]; 
-                ha = HA[d];
-                hb = HB[d];
-              }
-          else
-            if (ac < ap)
-              { c  = ap+1;
-                m  = n;
-                b  = t;
-                ha = ua;
-                hb = ub;
-              }
-            else
-              { c  = ac+2;
-                m  = M[k];
-                b  = T[k];
-                ha = HA[k];
-                hb = HB[k];
-              }
-
-          if ((b & PATH_TOP) != 0)
-            m -= 1;
-          b <<= 1;
-
-          y = (c-k) >> 1;
-          while (1)
-            { c = bseq[y];
-              if (c == 4)
+#ifdef WAVE_SIMD
+          if (k < kb && k-low >= 7 && spec->simd)
+            { kb = k-7;
+              wave_lanes(&lane,kb,1,aseq,bseq,V,M,HA,HB,T,ap,n,t,ua,ub);
+            }
+          if (k >= kb)
+            { d  = k-kb;
+              y  = lane.y[d];
+              m  = lane.m[d];
+              b  = lane.b[d];
+              ha = lane.ha[d];
+              hb = lane.hb[d];
+              if (lane.bend & (1 << d))
                 { more = 0;
                   if (bclip < k)
                     bclip = k;
-                  break;
                 }
-              d = a[y];
-              if (c != d)
-                { if (d == 4) 
-                    { more  = 0;
-                      aclip = k;
+              else if (lane.aend & (1 << d))
+                { more  = 0;
+                  aclip = k;
+                }
+            }
+          else
+#endif
+            { if (ac < am)
+                if (am < ap)
+                  { c  = ap+1;
+                    m  = n;
+                    b  = t;
+                    ha = ua;
+                    hb = ub;
+                  }
+                else
+                  { c  = am+1;
+                    m  = M[d];
+                    b  = T[d]; 
+                    ha = HA[d];
+                    hb = HB[d];
+                  }
+              else
+                if (ac < ap)
+                  { c  = ap+1;
+                    m  = n;
+                    b  = t;
+                    ha = ua;
+                    hb = ub;
+                  }
+                else
+                  { c  = ac+2;
+                    m  = M[k];
+                    b  = T[k];
+                    ha = HA[k];
+                    hb = HB[k];
+                  }
+
+              if ((b & PATH_TOP) != 0)
+                m -= 1;
+              b <<= 1;
+
+              y = (c-k) >> 1;
+              while (1)
+                { c = bseq[y];
+                  if (c == 4)
+                    { more = 0;
+                      if (bclip < k)
+                        bclip = k;
+                      break;
                     }
-                  break;
+                  d = a[y];
+                  if (c != d)
+                    { if (d == 4) 
+                        { more  = 0;
+                          aclip = k;
+                        }
+                      break;
+                    }
+                  y += 1;
+                  if ((b & PATH_TOP) == 0)
+                    m += 1;
+                  b = (b << 1) | 1;
                 }
-              y += 1;
-              if ((b & PATH_TOP) == 0)
-                m += 1;
-              b = (b << 1) | 1;
             }
           c = (y << 1) + k;
 
@@ -1228,6 +1493,10 @@ static int reverse_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
       BVEC   t;
       int    am, ac, ap;
       char  *a;
+#ifdef WAVE_SIMD
+      int        kb;
+      Wave_Lanes lane;
+#endif
 
       low -= 1;
       hgh += 1;
@@ -1330,6 +1599,9 @@ static int reverse_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
       t  = PATH_INT;
       n  = PATH_LEN;
       ua = ub = -1;
+#ifdef WAVE_SIMD
+      kb = low-8;
+#endif
       for (k = low; k <= hgh; k++)
         { int     y, m;
           int     ha, hb;
@@ -1341,62 +1613,87 @@ static int reverse_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
           ac = ap;
           ap = V[d = k+1];
 
-          if (ac > ap)
-            if (ap > am)
-              { c = am-1;
-                m  = n;
-                b  = t;
-                ha = ua;
-                hb = ub;
-              }
-            else
-              { c  = ap-1;
-                m  = M[d];
-                b  = T[d];
-                ha = HA[d];
-                hb = HB[d];
-              }
-          else
-            if (ac > am)
-              { c  = am-1;
-                m  = n;
-                b  = t;
-                ha = ua;
-                hb = ub;
-              }
-            else
-              { c  = ac-2;
-                m  = M[k];
-                b  = T[k];
-                ha = HA[k];
-                hb = HB[k];
-              }
-
-          if ((b & PATH_TOP) != 0)
-            m -= 1;
-          b <<= 1;
-
-          y = (c-k) >> 1;
-          while (1)
-            { c = bseq[y];
-              if (c == 4)
+#ifdef WAVE_SIMD
+          if (k > kb+7 && hgh-k >= 7 && spec->simd)
+            { kb = k;
+              wave_lanes(&lane,kb,0,aseq,bseq,V,M,HA,HB,T,am,n,t,ua,ub);
+            }
+          if (k <= kb+7)
+            { d  = k-kb;
+              y  = lane.y[d];
+              m  = lane.m[d];
+              b  = lane.b[d];
+              ha = lane.ha[d];
+              hb = lane.hb[d];
+              if (lane.bend & (1 << d))
                 { more = 0;
                   if (bclip > k)
                     bclip = k;
-                  break;
                 }
-              d = a[y];
-              if (c != d)
-                { if (d == 4) 
-                    { more  = 0;
-                      aclip = k;
+              else if (lane.aend & (1 << d))
+                { more  = 0;
+                  aclip = k;
+                }
+            }
+          else
+#endif
+            { if (ac > ap)
+                if (ap > am)
+                  { c = am-1;
+                    m  = n;
+                    b  = t;
+                    ha = ua;
+                    hb = ub;
+                  }
+                else
+                  { c  = ap-1;
+                    m  = M[d];
+                    b  = T[d];
+                    ha = HA[d];
+                    hb = HB[d];
+                  }
+              else
+                if (ac > am)
+                  { c  = am-1;
+                    m  = n;
+                    b  = t;
+                    ha = ua;
+                    hb = ub;
+                  }
+                else
+                  { c  = ac-2;
+                    m  = M[k];
+                    b  = T[k];
+                    ha = HA[k];
+                    hb = HB[k];
+                  }
+
+              if ((b & PATH_TOP) != 0)
+                m -= 1;
+              b <<= 1;
+
+              y = (c-k) >> 1;
+              while (1)
+                { c = bseq[y];
+                  if (c == 4)
+                    { more = 0;
+                      if (bclip > k)
+                        bclip = k;
+                      break;
                     }
-                  break;
+                  d = a[y];
+                  if (c != d)
+                    { if (d == 4) 
+                        { more  = 0;
+                          aclip = k;
+                        }
+                      break;
+                    }
+                  y -= 1;
+                  if ((b & PATH_TOP) == 0)
+                    m += 1;
+                  b = (b << 1) | 1;
                 }
-              y -= 1;
-              if ((b & PATH_TOP) == 0)
-                m += 1;
-              b = (b << 1) | 1;
             }
           c = (y << 1) + k;
 
@@ -5088,26 +5385,80 @@ static int middle_np(char *A, int M, char *B, int N, Trace_Waves *wave, int mode
 
 static char *TP_Error = "Trace point out of bounds (Compute_Trace), source DB likely incorrect";
 
-int Compute_Trace_PTS(Alignment *align, Work_Data *ework, int trace_spacing, int mode)
-{ _Work_Data *work = (_Work_Data *) ework;
+  /* Compute_Trace_PTS and Compute_Trace_MID trace the segments of an alignment, the parts
+     between successive trace points, in order.  Given the trace points each segment can be
+     traced on its own, so trace_range traces a range [beg,end) of them into the trace vector
+     of work and the _MT variants give ranges to threads and catenate their traces in order.
+     The indels of a trace are positions relative to the sequences of align so the result is
+     exactly that of the sequential routine.  dmax and nmax are those of the whole trace as
+     the alignment of a segment depends on dmax.
+  */
+
+#define TRACE_RANGE  64     //  Min. # of segments given to a thread
+
+typedef struct
+  { Alignment  *align;
+    _Work_Data *work;
+    int         trace_spacing;
+    int         mode;
+    int         mid;          //  Trace through the mid-points of the segments
+    int         dmax, nmax;   //  Max. diffs and B-length of a segment over the whole trace
+    int         nseg;         //  # of segments of the whole trace
+    int         beg, end;     //  Trace segments [beg,end)
+    int         tlen;         //  Length and diffs of the trace of the segments (on return)
+    int         diffs;
+    int         error;
+  } Trace_Range;
+
+  //  Set [*ab,*ae] x [*bb,*be] to the extent of segment s of the alignment of r.  If next
+  //    then *ab, *bb is already the start of segment s, otherwise it is found from the start
+  //    of the alignment
+
+static void trace_segment(Trace_Range *r, int s, int next, int *ab, int *ae, int *bb, int *be)
+{ Path   *path   = r->align->path;
+  uint16 *points = (uint16 *) path->trace;
+  int     tspace = r->trace_spacing;
+  int     base   = (path->abpos/tspace)*tspace;
+  int     i;
+
+  if (! next)
+    { *ab = path->abpos;
+      *bb = path->bbpos;
+      for (i = 0; i < s; i++)
+        *bb += points[2*i+1];
+      if (s > 0)
+        *ab = base + s*tspace;
+    }
+  if (s < r->nseg-1)
+    { *ae = base + (s+1)*tspace;
+      *be = *bb + points[2*s+1];
+    }
+  else
+    { *ae = path->aepos;
+      *be = path->bepos;
+    }
+}
+
+static int trace_range(Trace_Range *r)
+{ _Work_Data *work = r->work;
+  Alignment  *align = r->align;
   Trace_Waves wave;
 
-  Path   *path;
   char   *aseq, *bseq;
   int     alen, blen;
-  uint16 *points;
-  int     tlen;
+  int     trace_spacing, mode, dmax;
   int     ab, bb;
   int     ae, be;
-  int     diffs, dmax;
+  int     diffs;
 
   alen   = align->alen;
   blen   = align->blen;
-  path   = align->path;
   aseq   = align->aseq;
   bseq   = align->bseq;
-  tlen   = path->tlen;
-  points = (uint16 *) path->trace;
+  dmax   = r->dmax;
+  mode   = r->mode;
+
+  trace_spacing = r->trace_spacing;
 
   { int64 s;
     int   d;
@@ -5115,8 +5466,15 @@ int Compute_Trace_PTS(Alignment *align, Work_Data *ework, int trace_spacing, int
     int   nmax;
     int   **PVF, **PHF;
 
-    M = path->aepos-path->abpos;
-    N = path->bepos-path->bbpos;
+    if (r->mid && r->beg > 0)
+      trace_segment(r,r->beg-1,0,&ab,&ae,&bb,&be);
+    else
+      trace_segment(r,r->beg,0,&ab,&ae,&bb,&be);
+    M = ab;
+    N = bb;
+    trace_segment(r,r->end-1,0,&ab,&ae,&bb,&be);
+    M = ae-M;
+    N = be-N;
     if (M < N)
       s = N*sizeof(int);
     else
@@ -5125,18 +5483,11 @@ int Compute_Trace_PTS(Alignment *align, Work_Data *ework, int trace_spacing, int
       if (enlarge_trace(work,s))
         EXIT(1);
 
-    nmax = 0;
-    dmax = 0;
-    for (d = 1; d < tlen; d += 2)
-      { if (points[d-1] > dmax)
-          dmax = points[d-1];
-        if (points[d] > nmax)
-          nmax = points[d];
-      }
-    if (tlen <= 1)
-      nmax = N;
-
-    s = (dmax+3)*2*((trace_spacing+nmax+3)*sizeof(int) + sizeof(int *));
+    nmax = r->nmax;
+    if (r->mid)
+      s = (dmax+3)*4*((trace_spacing+nmax+3)*sizeof(int) + sizeof(int *));
+    else
+      s = (dmax+3)*2*((trace_spacing+nmax+3)*sizeof(int) + sizeof(int *));
 
     if (s > work->vecmax)
       if (enlarge_vector(work,s))
@@ -5158,176 +5509,186 @@ int Compute_Trace_PTS(Alignment *align, Work_Data *ework, int trace_spacing, int
   wave.Aabs = aseq;
   wave.Babs = bseq;
 
-  { int i, d;
+  if (r->mid)
+    { int i, d;
+      int as, bs;
+      int af, bf;
+
+      diffs = 0;
+      d     = 0;
+      if (r->beg > 0)
+        { trace_segment(r,r->beg-1,0,&ab,&ae,&bb,&be);
+          if (ae > alen || be > blen)
+            { EPRINTF(EPLACE,"%s: %s\n",Prog_Name,TP_Error);
+              EXIT(1);
+            }
+          if (middle_np(aseq+ab,ae-ab,bseq+bb,be-bb,&wave,mode,dmax))
+            EXIT(1);
+          as = wave.mida;
+          bs = wave.midb;
+          ab = ae;
+          bb = be;
+        }
+      else
+        { trace_segment(r,0,0,&ab,&ae,&bb,&be);
+          as = ab;
+          bs = bb;
+        }
+      for (i = r->beg; i < r->end; i++)
+        { trace_segment(r,i,1,&ab,&ae,&bb,&be);
+          if (ae > alen || be > blen)
+            { EPRINTF(EPLACE,"%s: %s\n",Prog_Name,TP_Error);
+              EXIT(1);
+            }
+          if (middle_np(aseq+ab,ae-ab,bseq+bb,be-bb,&wave,mode,dmax))
+            EXIT(1);
+          af = wave.mida;
+          bf = wave.midb;
+          d  = iter_np(aseq+as,af-as,bseq+bs,bf-bs,&wave,mode,dmax);
+          if (d < 0)
+            EXIT(1);
+          diffs += d;
+          ab = ae;
+          bb = be;
+          as = af;
+          bs = bf;
+        }
 
-    diffs = 0;
-    ab = path->abpos;
-    ae = (ab/trace_spacing)*trace_spacing;
-    bb = path->bbpos;
-    tlen -= 2;
-    for (i = 1; i < tlen; i += 2)
-      { ae = ae + trace_spacing;
-        be = bb + points[i];
-        if (ae > alen || be > blen)
-          { EPRINTF(EPLACE,"%s: %s\n",Prog_Name,TP_Error);
+      if (r->end == r->nseg)
+        { d += iter_np(aseq+as,ae-as,bseq+bs,be-bs,&wave,mode,dmax);
+          if (d < 0)
             EXIT(1);
-          }
-        d  = iter_np(aseq+ab,ae-ab,bseq+bb,be-bb,&wave,mode,dmax);
-        if (d < 0)
-          EXIT(1);
-        diffs += d;
-        ab = ae;
-        bb = be;
-      }
-    ae = path->aepos;
-    be = path->bepos;
-    if (ae > alen || be > blen)
-      { EPRINTF(EPLACE,"%s: %s\n",Prog_Name,TP_Error);
-        EXIT(1);
-      }
-    d  = iter_np(aseq+ab,ae-ab,bseq+bb,be-bb,&wave,mode,dmax);
-    if (d < 0)
-      EXIT(1);
-    diffs += d;
-  }
+          diffs += d;
+        }
+    }
 
-  path->trace = work->trace;
-  path->tlen  = wave.Stop - ((int *) path->trace);
-  path->diffs = diffs;
+  else
+    { int i, d;
+
+      diffs = 0;
+      trace_segment(r,r->beg,0,&ab,&ae,&bb,&be);
+      for (i = r->beg; i < r->end; i++)
+        { trace_segment(r,i,1,&ab,&ae,&bb,&be);
+          if (ae > alen || be > blen)
+            { EPRINTF(EPLACE,"%s: %s\n",Prog_Name,TP_Error);
+              EXIT(1);
+            }
+          d = iter_np(aseq+ab,ae-ab,bseq+bb,be-bb,&wave,mode,dmax);
+          if (d < 0)
+            EXIT(1);
+          diffs += d;
+          ab = ae;
+          bb = be;
+        }
+    }
 
+  r->tlen  = wave.Stop - ((int *) work->trace);
+  r->diffs = diffs;
   return (0);
 }
 
-int Compute_Trace_MID(Alignment *align, Work_Data *ework, int trace_spacing, int mode)
-{ _Work_Data *work = (_Work_Data *) ework;
-  Trace_Waves wave;
+static void *trace_thread(void *arg)
+{ Trace_Range *r = (Trace_Range *) arg;
 
-  Path   *path;
-  char   *aseq, *bseq;
-  int     alen, blen;
-  uint16 *points;
-  int     tlen;
-  int     ab, bb;
-  int     ae, be;
-  int     diffs, dmax;
+  r->error = trace_range(r);
+  return (NULL);
+}
 
-  alen   = align->alen;
-  blen   = align->blen;
-  path   = align->path;
-  aseq   = align->aseq;
-  bseq   = align->bseq;
-  tlen   = path->tlen;
-  points = (uint16 *) path->trace;
+static int compute_trace(Alignment *align, _Work_Data **work, int nthreads, int trace_spacing,
+                         int mode, int mid)
+{ Path   *path   = align->path;
+  uint16 *points = (uint16 *) path->trace;
+  int     tlen   = path->tlen;
+  int     dmax, nmax, nseg;
+  int     d;
+
+  nmax = 0;
+  dmax = 0;
+  for (d = 1; d < tlen; d += 2)
+    { if (points[d-1] > dmax)
+        dmax = points[d-1];
+      if (points[d] > nmax)
+        nmax = points[d];
+    }
+  if (tlen <= 1)
+    nmax = path->bepos-path->bbpos;
+
+  nseg = tlen/2;
+  if (nseg == 0)
+    nseg = 1;
+  if (nthreads > nseg/TRACE_RANGE)
+    nthreads = nseg/TRACE_RANGE;
+  if (nthreads < 1)
+    nthreads = 1;
+
+  { Trace_Range parm[nthreads];
+    pthread_t   threads[nthreads];
+    int64       s;
+    int         i, t, diffs;
+    int        *trace;
+
+    for (i = 0; i < nthreads; i++)
+      { parm[i].align = align;
+        parm[i].work  = work[i];
+        parm[i].trace_spacing = trace_spacing;
+        parm[i].mode  = mode;
+        parm[i].mid   = mid;
+        parm[i].dmax  = dmax;
+        parm[i].nmax  = nmax;
+        parm[i].nseg  = nseg;
+        parm[i].beg   = (((int64) nseg)*i)/nthreads;
+        parm[i].end   = (((int64) nseg)*(i+1))/nthreads;
+      }
 
-  { int64 s;
-    int   d;
-    int   M, N;
-    int   nmax;
-    int   **PVF, **PHF;
+    for (i = 1; i < nthreads; i++)
+      pthread_create(threads+i,NULL,trace_thread,parm+i);
+    parm[0].error = trace_range(parm);
+    for (i = 1; i < nthreads; i++)
+      pthread_join(threads[i],NULL);
 
-    M = path->aepos-path->abpos;
-    N = path->bepos-path->bbpos;
-    if (M < N)
-      s = N*sizeof(int);
-    else
-      s = M*sizeof(int);
-    if (s > work->tramax)
-      if (enlarge_trace(work,s))
+    for (i = 0; i < nthreads; i++)
+      if (parm[i].error)
         EXIT(1);
 
-    nmax = 0;
-    dmax = 0;
-    for (d = 1; d < tlen; d += 2)
-      { if (points[d-1] > dmax)
-          dmax = points[d-1];
-        if (points[d] > nmax)
-          nmax = points[d];
+    t     = parm[0].tlen;
+    diffs = parm[0].diffs;
+    for (i = 1; i < nthreads; i++)
+      { t     += parm[i].tlen;
+        diffs += parm[i].diffs;
       }
-    if (tlen <= 1)
-      nmax = N;
 
-    s = (dmax+3)*4*((trace_spacing+nmax+3)*sizeof(int) + sizeof(int *));
-
-    if (s > work->vecmax)
-      if (enlarge_vector(work,s))
+    s = t*sizeof(int);
+    if (s > work[0]->tramax)
+      if (enlarge_trace(work[0],s))
         EXIT(1);
 
-    wave.PVF = PVF = ((int **) (work->vector)) + 2;
-    wave.PHF = PHF = PVF + (dmax+3);
+    trace = ((int *) work[0]->trace) + parm[0].tlen;
+    for (i = 1; i < nthreads; i++)
+      { memcpy(trace,work[i]->trace,parm[i].tlen*sizeof(int));
+        trace += parm[i].tlen;
+      }
 
-    s = trace_spacing+nmax+3;
-    PVF[-2] = ((int *) (PHF + (dmax+1))) + (nmax+1);
-    for (d = -1; d <= dmax; d++)
-      PVF[d] = PVF[d-1] + s;
-    PHF[-2] = PVF[dmax] + s;
-    for (d = -1; d <= dmax; d++)
-      PHF[d] = PHF[d-1] + s;
+    path->trace = work[0]->trace;
+    path->tlen  = t;
+    path->diffs = diffs;
   }
 
-  wave.Stop = ((int *) work->trace);
-  wave.Aabs = aseq;
-  wave.Babs = bseq;
-
-  { int i, d;
-    int as, bs;
-    int af, bf;
-
-    diffs = 0;
-    ab = as = af = path->abpos;
-    ae = (ab/trace_spacing)*trace_spacing;
-    bb = bs = bf = path->bbpos;
-    tlen -= 2;
-    for (i = 1; i < tlen; i += 2) 
-      { ae = ae + trace_spacing;
-        be = bb + points[i];
-        if (ae > alen || be > blen)
-          { EPRINTF(EPLACE,"%s: %s\n",Prog_Name,TP_Error);
-            EXIT(1);
-          }
-        if (middle_np(aseq+ab,ae-ab,bseq+bb,be-bb,&wave,mode,dmax))
-          EXIT(1);
-        af = wave.mida;
-        bf = wave.midb;
-        d  = iter_np(aseq+as,af-as,bseq+bs,bf-bs,&wave,mode,dmax);
-        if (d < 0)
-          EXIT(1);
-        diffs += d;
-        ab = ae;
-        bb = be;
-        as = af;
-        bs = bf;
-      }
+  return (0);
+}
 
-    ae = path->aepos;
-    be = path->bepos;
+int Compute_Trace_PTS(Alignment *align, Work_Data *ework, int trace_spacing, int mode)
+{ return (compute_trace(align,(_Work_Data **) &ework,1,trace_spacing,mode,0)); }
 
-    if (ae > alen || be > blen)
-      { EPRINTF(EPLACE,"%s: %s\n",Prog_Name,TP_Error);
-        EXIT(1);
-      }
-    if (middle_np(aseq+ab,ae-ab,bseq+bb,be-bb,&wave,mode,dmax))
-      EXIT(1);
-    af = wave.mida;
-    bf = wave.midb;
-    d  = iter_np(aseq+as,af-as,bseq+bs,bf-bs,&wave,mode,dmax);
-    if (d < 0)
-      EXIT(1);
-    diffs += d;
-    as = af;
-    bs = bf;
-    
-    d += iter_np(aseq+af,ae-as,bseq+bf,be-bs,&wave,mode,dmax);
-    if (d < 0)
-      EXIT(1);
-    diffs += d;
-  }
+int Compute_Trace_MID(Alignment *align, Work_Data *ework, int trace_spacing, int mode)
+{ return (compute_trace(align,(_Work_Data **) &ework,1,trace_spacing,mode,1)); }
 
-  path->trace = work->trace;
-  path->tlen  = wave.Stop - ((int *) path->trace);
-  path->diffs = diffs;
+int Compute_Trace_PTS_MT(Alignment *align, Work_Data **ework, int nthreads,
+                         int trace_spacing, int mode)
+{ return (compute_trace(align,(_Work_Data **) ework,nthreads,trace_spacing,mode,0)); }
 
-  return (0);
-}
+int Compute_Trace_MID_MT(Alignment *align, Work_Data **ework, int nthreads,
+                         int trace_spacing, int mode)
+{ return (compute_trace(align,(_Work_Data **) ework,nthreads,trace_spacing,mode,1)); }
 
 int Compute_Trace_IRR(Alignment *align, Work_Data *ework, int mode)
 { _Work_Data *work = (_Work_Data *) ework;
@@ -219,7 +219,9 @@ void Complement_Seq(char *a, int n);
      storage supplied by the Work_Data packet and this space is reused with each call, so if
      one wants to retain the bread-path and the two trace point sequences, then they must be
      copied to user-allocated storage before calling the routine again.  NULL is returned in
-     the event of an error.
+     the event of an error.  Each sequence must be followed by its terminating 4 and then at
+     least 3 more addressable bytes, as in a block loaded with Read_All_Sequences, as the
+     vectorized inner loop reads a sequence 4 bytes at a time.
 
      Find_Extension is a variant of Local_Alignment that simply finds a local alignment that
      either ends (if prefix is non-zero) or begins (if prefix is zero) at the point
@@ -257,6 +259,18 @@ void Complement_Seq(char *a, int n);
   int Compute_Trace_PTS(Alignment *align, Work_Data *work, int trace_spacing, int mode);
   int Compute_Trace_MID(Alignment *align, Work_Data *work, int trace_spacing, int mode);
 
+  /* Compute_Trace_PTS_MT and Compute_Trace_MID_MT produce exactly the trace of Compute_Trace_PTS
+     and Compute_Trace_MID, respectively, but trace the segments of a long alignment with up to
+     nthreads threads, one per Work_Data in work[0..nthreads-1].  As for the other routines the
+     trace is left in the storage of work[0].  An alignment is only divided among threads in
+     ranges of at least 64 segments, so short alignments are traced by the calling thread alone.
+  */
+
+  int Compute_Trace_PTS_MT(Alignment *align, Work_Data **work, int nthreads,
+                           int trace_spacing, int mode);
+  int Compute_Trace_MID_MT(Alignment *align, Work_Data **work, int nthreads,
+                           int trace_spacing, int mode);
+
   /* Compute_Trace_IRR (IRR for IRRegular) computes a trace for the given alignment where
      it assumes the spacing between trace points between both the A and B read varies, and
      futher assumes that the A-spacing is given in the short integers normally occupied by
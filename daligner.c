@@ -39,6 +39,8 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
 #include <dirent.h>
 
 #include <sys/param.h>
@@ -50,22 +52,39 @@
 #include "filter.h"
 
 static char *Usage[] =
-  { "[-vabAI] [-k<int(14)>] [-w<int(6)>] [-h<int(35)>] [-t<int>] [-M<int>] [-P<dir(/tmp)>]",
-    "         [-e<double(.70)] [-l<int(1000)>] [-s<int(100)>] [-H<int>] [-T<int(4)>]",
-    "         [-m<track>]+ <subject:db|dam> <target:db|dam> ...",
+  { "[-vabAIXRCSUFONLJ] [-k<int(14)>] [-w<int(6)>] [-h<int(35)>] [-t<int>] [-K<int>] [-M<int>]",
+    "         [-P<dir(/tmp)>] [-e<double(.70)] [-l<int(1000)>] [-s<int(100)>] [-H<int>] [-j<int>]",
+    "         [-T<int(4)>] [-W<int>] [-p<seed>]+ [-m<track>]+",
+    "         <subject:db|dam> <target:db|dam> ...",
   };
 
 int     VERBOSE;   //   Globally visible to filter.c
 int     BIASED;
+int     WINDOW;
+int     INPLACE;
+int     CANONICAL;
+int     SLABS;
+int     KFREQ;
+int     MINHASH;
+int     MHAUDIT;
+int     FUSED;
+int     ORDERED;
+int     NUMA;
+int     HUGEPAGE;
 int     MINOVER;
 int     HGAP_MIN;
 int     SYMMETRIC;
 int     IDENTITY;
+int     NSEED;
+char   *SEED[MAX_SEEDS];
 char   *SORT_PATH;
 
 uint64  MEM_LIMIT;
 uint64  MEM_PHYSICAL;
 
+static int KIDX;      //  Load (or build and save) persistent .kidx block indices
+static int PREFETCH;  //  Index the next target while comparing against the current one
+
 /*  Adapted from code by David Robert Nadeau (http://NadeauSoftware.com) licensed under
  *     "Creative Commons Attribution 3.0 Unported License"
  *          (http://creativecommons.org/licenses/by/3.0/deed.en_US)
@@ -396,6 +415,9 @@ static int read_DB(DAZZ_DB *block, char *name, char **mask, int *mstat, int mtop
       block->tracks = track;
     }
 
+  for (i = 0; i < NSEED; i++)
+    if ((int) strlen(SEED[i]) > kmer)
+      kmer = strlen(SEED[i]);
   if (block->cutoff < kmer)
     { for (i = 0; i < block->nreads; i++)
         if (block->reads[i].rlen < kmer)
@@ -410,114 +432,115 @@ static int read_DB(DAZZ_DB *block, char *name, char **mask, int *mstat, int mtop
   return (isdam);
 }
 
-static void complement(char *s, int len)
-{ char *t;
-  int   c;
-
-  t = s + (len-1);
-  while (s < t)
-    { c = *s;
-      *s = (char) (3-*t);
-      *t = (char) (3-c);
-      s += 1;
-      t -= 1;
+  //  Get the k-mer index for block, from its .kidx file if KIDX is set and it is up to date
+
+static void *get_index(DAZZ_DB *block, int comp, int *len)
+{ void *index;
+
+  if (KIDX)
+    { index = Load_Kmer_Index(block,comp,NULL,len);
+      if (index != NULL)
+        return (index);
     }
-  if (s == t)
-    *s = (char) (3-*s);
+  index = Sort_Kmers(block,comp,len);
+  if (KIDX)
+    Save_Kmer_Index(block,comp,NULL,index);
+  return (index);
 }
 
-static DAZZ_DB *complement_DB(DAZZ_DB *block, int inplace)
-{ static DAZZ_DB _cblock, *cblock = &_cblock;
-  int            nreads;
-  DAZZ_READ     *reads;
-  char          *seq;
-  
-  nreads = block->nreads;
-  reads  = block->reads;
-  if (inplace)
-    { seq = (char *) block->bases;
-      cblock = block;
-    }
-  else
-    { seq  = (char *) Malloc(block->reads[nreads].boff+1,"Allocating dazzler sequence block");
-      if (seq == NULL)
-        Clean_Exit(1);
-      *seq++ = 4;
-      memmove(seq,block->bases,block->reads[nreads].boff);
-      *cblock = *block;
-      cblock->bases  = (void *) seq;
-      cblock->tracks = NULL;
+  //  Pipelining (-F): while the comparisons against one target are in progress, a child
+  //    process reads the next target and builds its indices with T/2 of the -T threads,
+  //    saving them to scratch files in SORT_PATH (or as .kidx files if -X) that are mapped
+  //    when the target's turn comes.  The comparisons run with the other T-T/2 threads until
+  //    the child is waited for, and the memory set aside for it is withheld from MEM_LIMIT.
+
+static pid_t  PF_pid = 0;     //  Child indexing target argv[PF_target], 0 if none
+static int    PF_target;
+static uint64 PF_mem;
+static int    PF_threads;     //  The -T threads, restored when the child is waited for
+static int    PF_child = 0;   //  Set in the child
+
+static void start_prefetch(char *bfile, int target, char **mask, int *mstat, int mtop,
+                           int kmer, int nthreads)
+{ DAZZ_DB _stub, *stub = &_stub;
+  uint64  need;
+  pid_t   pid;
+
+  if (nthreads < 2)
+    return;
+
+  //  The untrimmed size of the target, from the .db stub and its reads in the .idx file
+
+  if (Open_DB(bfile,stub) < 0)
+    return;
+  need = (stub->totlen + stub->nreads) * (INPLACE ? 16 : 32) + 2*stub->totlen;
+  Close_DB(stub);
+  if (MEM_LIMIT > 0 && need > MEM_LIMIT/3)
+    return;
+
+  fflush(stdout);
+  fflush(stderr);
+  pid = fork();
+  if (pid < 0)
+    return;
+
+  if (pid == 0)
+    { DAZZ_DB _block, *block = &_block;
+      void   *index;
+      int     comp, len;
+
+      PF_child = 1;
+      VERBOSE  = 0;
+      if (Set_Filter_Threads(nthreads/2))
+        _exit (1);
+
+      read_DB(block,bfile,mask,mstat,mtop,kmer);
+      for (comp = 0; comp <= 1 - CANONICAL; comp++)
+        { if (KIDX)
+            index = get_index(block,comp,&len);
+          else
+            { index = Sort_Kmers(block,comp,&len);
+              if (index != NULL && Save_Kmer_Index(block,comp,SORT_PATH,index))
+                _exit (1);
+            }
+        }
+      _exit (0);
     }
 
-  { int   i;
-    float x;
-
-    x = cblock->freq[0];
-    cblock->freq[0] = cblock->freq[3];
-    cblock->freq[3] = x;
+  PF_pid     = pid;
+  PF_target  = target;
+  PF_mem     = (MEM_LIMIT > 0 ? need : 0);
+  PF_threads = nthreads;
+  MEM_LIMIT -= PF_mem;
+  Set_Filter_Threads(nthreads - nthreads/2);
+}
 
-    x = cblock->freq[1];
-    cblock->freq[1] = cblock->freq[2];
-    cblock->freq[2] = x;
+  //  Wait for the child indexing target, if any.  Returns 1 if it succeeded.
 
-    for (i = 0; i < nreads; i++)
-      complement(seq+reads[i].boff,reads[i].rlen);
-  }
+static int finish_prefetch(int target)
+{ int status;
 
-  { DAZZ_TRACK *src, *trg;
-    int        *data, *tata;
-    int         i, x, rlen;
-    int64      *tano, *anno;
-    int64       j, k;
+  if (PF_pid <= 0 || PF_target != target)
+    return (0);
+  if (waitpid(PF_pid,&status,0) < 0)
+    status = 1;
+  PF_pid = 0;
+  MEM_LIMIT += PF_mem;
+  Set_Filter_Threads(PF_threads);
+  return (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
 
-    for (src = block->tracks; src != NULL; src = src->next)
-      { tano = (int64 *) src->anno;
-        tata = (int   *) src->data;
+  //  The index of block (a target), mapped from a prefetched file if available
 
-        if (inplace)
-          { data = tata;
-            anno = tano;
-            trg  = src;
-          }
-        else
-          { data = (int *) Malloc(sizeof(int)*tano[nreads],
-                                  "Allocating dazzler interval track data");
-            anno = (int64 *) Malloc(sizeof(int64)*(nreads+1),
-                                    "Allocating dazzler interval track index");
-            trg  = (DAZZ_TRACK *) Malloc(sizeof(DAZZ_TRACK),
-                                         "Allocating dazzler interval track header");
-            if (data == NULL || trg == NULL || anno == NULL)
-              Clean_Exit(1);
-
-            trg->name = Strdup(src->name,"Copying track name");
-            if (trg->name == NULL)
-              Clean_Exit(1);
-
-            trg->size = 4;
-            trg->anno = (void *) anno;
-            trg->data = (void *) data;
-            trg->next = cblock->tracks;
-            cblock->tracks = trg;
-          }
+static void *target_index(DAZZ_DB *block, int comp, int fetched, int *len)
+{ void *index;
 
-        for (i = 0; i < nreads; i++)
-          { rlen = reads[i].rlen;
-            anno[i] = tano[i];
-            j = tano[i+1]-1;
-            k = tano[i];
-            while (k < j)
-              { x = tata[j];
-                data[j--] = rlen - tata[k];
-                data[k++] = rlen - x;
-              }
-            if (k == j)
-              data[k] = rlen - tata[k];
-          }
-        anno[nreads] = tano[nreads];
-      }
-  }
-
-  return (cblock);
+  if (fetched)
+    { index = Load_Kmer_Index(block,comp,KIDX ? NULL : SORT_PATH,len);
+      if (index != NULL)
+        return (index);
+    }
+  return (get_index(block,comp,len));
 }
 
 static char *CommandBuffer(char *aname, char *bname, char *spath)
@@ -539,6 +562,13 @@ static char *CommandBuffer(char *aname, char *bname, char *spath)
 void Clean_Exit(int val)
 { char *command;
 
+  if (PF_child)
+    _exit (val);
+  if (PF_pid > 0)
+    { kill(PF_pid,SIGKILL);
+      waitpid(PF_pid,NULL,0);
+    }
+
   command = CommandBuffer("","",SORT_PATH);
   sprintf(command,"rm -r %s",SORT_PATH);
   if (system(command) != 0)
@@ -580,7 +610,11 @@ int main(int argc, char *argv[])
     KMER_LEN  = 14;
     HIT_MIN   = 35;
     BIN_SHIFT = 6;
+    WINDOW    = 0;       //   Globally visible to filter.c
     MAX_REPS  = 0;
+    KFREQ     = 0;
+    MINHASH   = 0;
+    NSEED     = 0;
     HGAP_MIN  = 0;
     AVE_ERROR = .70;
     SPACING   = 100;
@@ -607,7 +641,7 @@ int main(int argc, char *argv[])
       if (argv[i][0] == '-')
         switch (argv[i][1])
         { default:
-            ARG_FLAGS("vabAI")
+            ARG_FLAGS("vabAIXRCSUFONLJ")
             break;
           case 'k':
             ARG_POSITIVE(KMER_LEN,"K-mer length")
@@ -619,12 +653,29 @@ int main(int argc, char *argv[])
           case 'w':
             ARG_POSITIVE(BIN_SHIFT,"Log of bin width")
             break;
+          case 'W':
+            ARG_POSITIVE(WINDOW,"Minimizer window")
+            if (WINDOW > 256)
+              { fprintf(stderr,"%s: Minimizer window must be 256 or less\n",Prog_Name);
+                exit (1);
+              }
+            break;
           case 'h':
             ARG_POSITIVE(HIT_MIN,"Hit threshold (in bp.s)")
             break;
           case 't':
             ARG_POSITIVE(MAX_REPS,"Tuple supression frequency")
             break;
+          case 'K':
+            ARG_POSITIVE(KFREQ,"DB-wide tuple supression frequency")
+            break;
+          case 'j':
+            ARG_POSITIVE(MINHASH,"Shared sketch hashes")
+            if (MINHASH > MH_SIZE)
+              { fprintf(stderr,"%s: Shared sketch hashes must be %d or less\n",Prog_Name,MH_SIZE);
+                exit (1);
+              }
+            break;
           case 'H':
             ARG_POSITIVE(HGAP_MIN,"HGAP threshold (in bp.s)")
             break;
@@ -659,6 +710,13 @@ int main(int argc, char *argv[])
               }
             MASK[MTOP++] = argv[i]+2;
             break;
+          case 'p':
+            if (NSEED >= MAX_SEEDS)
+              { fprintf(stderr,"%s: At most %d seed patterns may be given\n",Prog_Name,MAX_SEEDS);
+                exit (1);
+              }
+            SEED[NSEED++] = argv[i]+2;
+            break;
           case 'P':
             SORT_PATH = argv[i]+2;
             if ((dirp = opendir(SORT_PATH)) == NULL)
@@ -680,18 +738,36 @@ int main(int argc, char *argv[])
     SYMMETRIC = 1-flags['A'];
     IDENTITY  = flags['I'];
     MAP_ORDER = flags['a'];
+    KIDX      = flags['X'];
+    INPLACE   = flags['R'];   //  Globally declared in filter.h
+    CANONICAL = flags['C'];   //  Globally declared in filter.h
+    SLABS     = flags['S'];   //  Globally declared in filter.h
+    FUSED     = flags['U'];   //  Globally declared in filter.h
+    PREFETCH  = flags['F'];
+    ORDERED   = flags['O'];   //  Globally declared in filter.h
+    NUMA      = flags['N'];   //  Globally declared in filter.h
+    HUGEPAGE  = flags['L'];   //  Globally declared in filter.h
+    MHAUDIT   = flags['J'];   //  Globally declared in filter.h
 
     if (argc <= 2)
       { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage[0]);
         fprintf(stderr,"       %*s %s\n",(int) strlen(Prog_Name),"",Usage[1]);
         fprintf(stderr,"       %*s %s\n",(int) strlen(Prog_Name),"",Usage[2]);
+        fprintf(stderr,"       %*s %s\n",(int) strlen(Prog_Name),"",Usage[3]);
         fprintf(stderr,"\n");
         fprintf(stderr,"      -k: k-mer size (must be <= 32).\n");
         fprintf(stderr,"      -w: Look for k-mers in averlapping bands of size 2^-w.\n");
         fprintf(stderr,"      -h: A seed hit if the k-mers in band cover >= -h bps in the");
         fprintf(stderr," targest read.\n");
         fprintf(stderr,"      -t: Ignore k-mers that occur >= -t times in a block.\n");
+        fprintf(stderr,"      -K: Ignore k-mers that occur >= -K times in the DB (per DBkcount).\n");
         fprintf(stderr,"      -M: Use only -M GB of memory by ignoring most frequent k-mers.\n");
+        fprintf(stderr,"      -S: Fit -M by comparing slabs of the subject reads in turn instead.\n");
+        fprintf(stderr,"      -U: Count and merge k-mer hits in one pass when they fit -M.\n");
+        fprintf(stderr,"      -W: Seed only with the (-W,-k)-minimizers of each read.\n");
+        fprintf(stderr,"      -p: Seed with spaced seed pattern(s), e.g. 1101100110101100111.\n");
+        fprintf(stderr,"      -j: Skip read pairs sharing < -j of the %d least k-mer hashes of each.\n",
+                       MH_SIZE);
         fprintf(stderr,"\n");
         fprintf(stderr,"      -e: Look for alignments with -e percent similarity.\n");
         fprintf(stderr,"      -l: Look for alignments of length >= -l.\n");
@@ -708,6 +784,60 @@ int main(int argc, char *argv[])
         fprintf(stderr,"          off => sort .las by A,B-read pairs for overlap piles\n");
         fprintf(stderr,"      -A: Compare subjet to target, but not vice versa.\n");
         fprintf(stderr,"      -I: Compare reads to themselves\n");
+        fprintf(stderr,"      -X: Load block k-mer indices from .kidx files, build & save if absent\n");
+        fprintf(stderr,"      -R: Radix sort k-mers and hits in place, using half the memory\n");
+        fprintf(stderr,"      -C: Index canonical k-mers once and find both orientations in one pass\n");
+        fprintf(stderr,"      -F: Index the next target block in the background (in -P) with T/2 threads\n");
+        fprintf(stderr,"      -O: Sort overlaps in memory and write each .las without LAsort/LAmerge\n");
+        fprintf(stderr,"      -N: Pin threads to NUMA nodes and place their data on them\n");
+        fprintf(stderr,"      -L: Back the large k-mer and hit arrays with huge pages\n");
+        fprintf(stderr,"      -J: With -j -v, skip no pairs but report the overlaps -j would lose\n");
+        exit (1);
+      }
+
+    if (KFREQ > 0 && BIASED)
+      { fprintf(stderr,"%s: -K excludes -b\n",Prog_Name);
+        exit (1);
+      }
+
+    for (k = 0; k < NSEED; k++)
+      { char *c = SEED[k];
+        int   w, n;
+
+        w = 0;
+        for (n = 0; c[n] == '0' || c[n] == '1'; n++)
+          w += (c[n] == '1');
+        if (c[n] != '\0' || n > 32 || c[0] != '1' || c[n-1] != '1')
+          { fprintf(stderr,"%s: Seed pattern %s is not a 0/1 string of length <= 32",
+                           Prog_Name,c);
+            fprintf(stderr," that begins and ends with a 1\n");
+            exit (1);
+          }
+        if (k > 0 && w != KMER_LEN)
+          { fprintf(stderr,"%s: Seed patterns must all have the same number of 1's\n",
+                           Prog_Name);
+            exit (1);
+          }
+        KMER_LEN = w;
+        if (CANONICAL)
+          { for (w = 0; w < n; w++)
+              if (c[w] != c[(n-1)-w])
+                break;
+            if (NSEED > 1 || w < n)
+              { fprintf(stderr,"%s: -C with -p requires a single, symmetric seed pattern\n",
+                               Prog_Name);
+                exit (1);
+              }
+          }
+      }
+    if (NSEED > 0 && (KFREQ > 0 || BIASED))
+      { fprintf(stderr,"%s: -p excludes -K and -b\n",Prog_Name);
+        exit (1);
+      }
+
+    if (CANONICAL && (BIASED || KMER_LEN > 31))
+      { fprintf(stderr,"%s: -C requires a k-mer length of 31 or less and excludes -b\n",
+                       Prog_Name);
         exit (1);
       }
 
@@ -749,13 +879,14 @@ int main(int argc, char *argv[])
 
   // Compare against reads in B in both orientations
 
-  { int   i, j;
+  { int   i, j, fetched;
     char *command;
 
     aindex = NULL;
     broot  = NULL;
     for (i = 2; i < argc; i++)
-      { bfile = argv[i];
+      { bfile   = argv[i];
+        fetched = finish_prefetch(i);
         if (strcmp(afile,bfile) != 0)
           { isdam = read_DB(bblock,bfile,MASK,MSTAT,MTOP,KMER_LEN);
             if (isdam)
@@ -778,35 +909,56 @@ int main(int argc, char *argv[])
 
             if (VERBOSE)
               printf("\nBuilding index for %s\n",aroot);
-            aindex = Sort_Kmers(ablock,&alen);
+            aindex = get_index(ablock,0,&alen);
           }
 
         if (aroot != broot)
           { if (VERBOSE)
               printf("\nBuilding index for %s\n",broot);
-            bindex = Sort_Kmers(bblock,&blen);
+            bindex = target_index(bblock,0,fetched,&blen);
+
+            if (PREFETCH && i+1 < argc && strcmp(afile,argv[i+1]) != 0)
+              start_prefetch(argv[i+1],i+1,MASK,MSTAT,MTOP,KMER_LEN,NTHREADS);
+
             Match_Filter(aroot,ablock,broot,bblock,aindex,alen,bindex,blen,0,asettings);
 
-            bblock = complement_DB(bblock,1);
-            if (VERBOSE)
-              printf("\nBuilding index for c(%s)\n",broot);
-            bindex = Sort_Kmers(bblock,&blen);
+            //  With canonical k-mers the index of B also serves the comparison with c(B),
+            //    whose hits were (in most cases) already found by the call above
+
+            if ( ! CANONICAL)
+              { Free_Kmer_Index(bindex);
+                if (VERBOSE)
+                  printf("\nBuilding index for c(%s)\n",broot);
+                bindex = target_index(bblock,1,fetched,&blen);
+              }
             Match_Filter(aroot,ablock,broot,bblock,aindex,alen,bindex,blen,1,asettings);
+            Free_Kmer_Index(bindex);
+
+            Close_DB(bblock);
           }
         else
-          { Match_Filter(aroot,ablock,aroot,ablock,aindex,alen,aindex,alen,0,asettings);
+          { if (PREFETCH && i+1 < argc && strcmp(afile,argv[i+1]) != 0)
+              start_prefetch(argv[i+1],i+1,MASK,MSTAT,MTOP,KMER_LEN,NTHREADS);
 
-            bblock = complement_DB(ablock,0);
-            if (VERBOSE)
-              printf("\nBuilding index for c(%s)\n",aroot);
-            bindex = Sort_Kmers(bblock,&blen);
-            Match_Filter(aroot,ablock,aroot,bblock,aindex,alen,bindex,blen,1,asettings);
+            Match_Filter(aroot,ablock,aroot,ablock,aindex,alen,aindex,alen,0,asettings);
 
-            bblock->reads = NULL;  //  ablock & bblock share "reads" vector, don't let Close_DB
-                                   //     free it !
+            if (CANONICAL)
+              Match_Filter(aroot,ablock,aroot,ablock,aindex,alen,aindex,alen,1,asettings);
+            else
+              { if (VERBOSE)
+                  printf("\nBuilding index for c(%s)\n",aroot);
+                bindex = get_index(ablock,1,&blen);
+                Match_Filter(aroot,ablock,aroot,ablock,aindex,alen,bindex,blen,1,asettings);
+                Free_Kmer_Index(bindex);
+              }
           }
 
-        Close_DB(bblock);
+        if (ORDERED)
+          { Write_Sorted_Overlaps(aroot,broot,MAP_ORDER);
+            if (aroot != broot)
+              free(broot);
+            continue;
+          }
 
         command = CommandBuffer(aroot,broot,SORT_PATH);
 
@@ -15,17 +15,29 @@
 
 //  A complete threaded code for the filter
 
+#define _GNU_SOURCE     //  For CPU affinity of threads (-N)
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <math.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "DB.h"
 #include "filter.h"
 #include "align.h"
+#include "kfreq.h"
 
 #undef FOR_PACBIO
 
@@ -34,12 +46,14 @@
 #define MAX_BIAS  2    //  In -b mode, don't consider tuples with specificity
                        //     <= 4 ^ -(kmer-MAX_BIAS)
 #define MAXGRAM 10000  //  Cap on k-mer count histogram (in count_thread, merge_thread)
+#define MAX_WINDOW 256 //  Largest minimizer window (-W)
 
 #define PANEL_SIZE     50000   //  Size to break up very long A-reads
 #define PANEL_OVERLAP  10000   //  Overlap of A-panels
 
 #define MATCH_CHUNK    100     //  Max expected number of hits between two reads
 #define TRACE_CHUNK  20000     //  Max expected trace points in hits between two reads
+#define HOT_CHUNK     1000    //  Max expected number of seed hits in a panel of an A-read
 
 #undef  TEST_LSORT
 #undef  TEST_KSORT
@@ -108,6 +122,36 @@ typedef struct
 
 #endif
 
+  //  When a block's read indices and positions are small enough, a k-mer is packed into a
+  //    single uint64 as [0 | code | 0... | read | rpos] where the code occupies the 2*Kmer bits
+  //    just below the top bit.  As the code is in the same place for every block, the codes
+  //    of any two packed lists are compared simply as v >> PK_shift, and the all-ones sentinel
+  //    compares greater than every code as it does for a KmerPos.
+
+  //  The MinHash sketches of a block's reads (see MINHASH PRE-FILTER below)
+
+typedef struct
+  { int     nreads;
+    uint32 *hash;     //  hash[r*MH_SIZE ...] are the least hashes of read r, MH_NONE padded
+    uint64 *post;     //  [hash | read] of every sketch entry, grouped by the top bbits of hash
+    int64  *bucket;   //  post[bucket[x],bucket[x+1]) are the entries whose hash has top bits x
+    int     bbits;
+  } Sketch;
+
+typedef struct
+  { KmerPos *list;    //  Sorted k-mers, list[len] and list[len+1] are sentinels
+    int      len;     //  Number of k-mers in list
+    int      rshift;  //  If > 0 then list is really a packed uint64 list with rshift rpos bits
+    int      rmask;   //    and read = (v >> rshift) & rmask
+    int64    msize;   //  Size of mmap'd .kidx file (0 if list is on the heap)
+    void    *mbase;   //  Start of the mapping
+    Sketch  *sketch;  //  Sketches of the block's reads if MINHASH, NULL otherwise
+  } Kmer_Index;
+
+#define PK_CODE(v)          ((v) >> PK_shift)
+#define PK_READ(v,rsh,rmk)  ((int) (((v) >> (rsh)) & (rmk)))
+#define PK_RPOS(v,pmk)      ((int) ((v) & (pmk)))
+
 /*******************************************************************************************
  *
  *  PARAMETER SETUP
@@ -121,10 +165,35 @@ static int Suppress;
 
 static int    Kshift;         //  2*Kmer
 static uint64 Kmask;          //  4^Kmer-1
+static int    Kbits;          //  Kshift+CANONICAL, the # of bits in a k-mer code
 static int    TooFrequent;    //  (Suppress != 0) ? Suppress : INT32_MAX
 
-static int    NTHREADS;       //  Adjusted downward to nearest power of 2
-static int    NSHIFT;         //  NTHREADS = 1 << NSHIFT
+static int    NTHREADS;       //  # of threads for every parallel phase
+static int    MAXTHREADS = 0; //  Largest NTHREADS set, the size of the per-thread arrays kept
+                              //    between calls of Match_Filter
+static int    PK_shift;       //  = 63-Kbits, the position of the code in a packed k-mer
+
+  //  Spaced seeds (-p): every pattern is right-justified in a window of Kspan bases, whose
+  //    2-bit codes are rolled into a uint64 as for a k-mer, and its code is gathered from the
+  //    window a run of 1's at a time: for each run, shift it down, mask it, and shift it into
+  //    place.  Codes of different patterns are XOR'd with distinct constants so that a seed
+  //    of one pattern is not taken for a seed of another.
+
+typedef struct
+  { int    nrun;          //  # of runs of 1's in the pattern
+    int    rsh[16];       //  Run i is ((w >> rsh[i]) & mask[i]) << lsh[i] of a window w
+    int    lsh[16];
+    uint64 mask[16];
+    uint64 flip;          //  XOR'd into the code
+  } Seed_Code;
+
+static int       Kspan;               //  Bases spanned by a seed, Kmer if contiguous k-mers
+static int       Kper;                //  Seeds listed per read position, max(NSEED,1)
+static uint64    Wmask;               //  4^Kspan-1
+static Seed_Code SD_code[MAX_SEEDS];
+
+static void numa_setup();     //  See NUMA PLACEMENT below
+static Sketch *sketch_block(DAZZ_DB *block);    //  See MINHASH PRE-FILTER below
 
 int Set_Filter_Params(int kmer, int binshift, int suppress, int hitmin, int nthread)
 { if (kmer <= 1)
@@ -146,17 +215,365 @@ int Set_Filter_Params(int kmer, int binshift, int suppress, int hitmin, int nthr
   else
     TooFrequent = Suppress;
 
-  NTHREADS = 1;
-  NSHIFT   = 0;
-  while (2*NTHREADS <= nthread)
-    { NTHREADS *= 2;
-      NSHIFT   += 1;
+  Kbits    = Kshift + CANONICAL;
+  PK_shift = 63-Kbits;
+
+  Kspan = Kmer;
+  Kper  = 1;
+  if (NSEED > 0)
+    { Seed_Code *sd;
+      int        j, u, v, len, nb;
+
+      Kspan = 0;
+      for (j = 0; j < NSEED; j++)
+        if ((len = strlen(SEED[j])) > Kspan)
+          Kspan = len;
+      Kper = NSEED;
+
+      for (j = 0; j < NSEED; j++)
+        { sd  = SD_code + j;
+          len = strlen(SEED[j]);
+          nb  = 0;
+          sd->nrun = 0;
+          for (v = len-1; v >= 0; v = u)
+            { if (SEED[j][v] != '1')
+                { u = v-1;
+                  continue;
+                }
+              for (u = v; u >= 0 && SEED[j][u] == '1'; u--)
+                ;
+              if (sd->nrun >= 16)
+                return (1);
+              sd->rsh[sd->nrun]  = 2*(len-1-v);
+              sd->lsh[sd->nrun]  = 2*nb;
+              sd->mask[sd->nrun] = (v-u == 32) ? 0xffffffffffffffffllu : (0x1llu << 2*(v-u)) - 1;
+              sd->nrun += 1;
+              nb += v-u;
+            }
+          if (nb != Kmer)
+            return (1);
+          sd->flip = (j * 0x9e3779b97f4a7c15llu) & Kmask;
+        }
     }
+  if (Kspan == 32)
+    Wmask = 0xffffffffffffffffllu;
+  else
+    Wmask = (0x1llu << 2*Kspan) - 1;
+
+  return (Set_Filter_Threads(nthread));
+}
+
+int Set_Filter_Threads(int nthread)
+{ if (nthread <= 0 || (MAXTHREADS > 0 && nthread > MAXTHREADS))
+    return (1);
+  NTHREADS = nthread;
+  if (MAXTHREADS == 0)
+    MAXTHREADS = nthread;
+
+  numa_setup();
 
   return (0);
 }
 
 
+/*******************************************************************************************
+ *
+ *  NUMA PLACEMENT (-N) AND BANDWIDTH
+ *
+ ********************************************************************************************/
+
+  //  Thread i of every parallel phase works on the i'th partition of the arrays it streams,
+  //    so with NUMA set it is pinned to node (i*nodes)/NTHREADS and the pages of each
+  //    large array are first touched by the thread whose partition they hold, placing them
+  //    on its node.  Each thread's radix histogram is likewise on a page of its own node.
+
+#define MAX_NODES 64
+#define PAGE_SIZE 4096
+
+static pthread_attr_t *NM_attr = NULL;  //  Attributes pinning thread i, NULL if not pinning
+static int             NM_nattr;        //  # of attributes in NM_attr
+static int64          *NM_hist = NULL;  //  Thread i's radix histogram is NM_hist + i*NM_hslot
+static int64           NM_hslot;
+static int64           NM_hsize;        //  Bytes mapped at NM_hist
+
+static int node_cpus(int node, cpu_set_t *cpus)
+{ char  name[100];
+  FILE *f;
+  int   a, b, c;
+
+  sprintf(name,"/sys/devices/system/node/node%d/cpulist",node);
+  f = fopen(name,"r");
+  if (f == NULL)
+    return (0);
+  CPU_ZERO(cpus);
+  while (fscanf(f,"%d",&a) == 1)
+    { b = a;
+      c = fgetc(f);
+      if (c == '-')
+        { if (fscanf(f,"%d",&b) != 1)
+            break;
+          c = fgetc(f);
+        }
+      for ( ; a <= b && a < CPU_SETSIZE; a++)
+        CPU_SET(a,cpus);
+      if (c != ',')
+        break;
+    }
+  fclose(f);
+  return (CPU_COUNT(cpus) > 0);
+}
+
+static inline pthread_attr_t *thread_attr(int i)
+{ if (NM_attr == NULL)
+    return (NULL);
+  return (NM_attr + i);
+}
+
+typedef struct
+  { char  *beg;
+    char  *end;
+  } Touch_Arg;
+
+static void *touch_thread(void *arg)
+{ Touch_Arg *data = (Touch_Arg *) arg;
+  char      *p;
+
+  for (p = data->beg; p < data->end; p += PAGE_SIZE)
+    *p = 0;
+  return (NULL);
+}
+
+  //  Touch the pages of the bytes bytes at array so that the i'th of NTHREADS equal parts is
+  //    placed on the node of thread i.  The contents of array are undefined afterwards.
+
+static void numa_touch(void *array, int64 bytes)
+{ THREAD    threads[NTHREADS];
+  Touch_Arg parmt[NTHREADS];
+  int       i;
+
+  if (NM_attr == NULL || array == NULL)
+    return;
+
+  for (i = 0; i < NTHREADS; i++)
+    { parmt[i].beg = ((char *) array) + (bytes * i) / NTHREADS;
+      parmt[i].end = ((char *) array) + (bytes * (i+1)) / NTHREADS;
+      pthread_create(threads+i,thread_attr(i),touch_thread,parmt+i);
+    }
+  for (i = 0; i < NTHREADS; i++)
+    pthread_join(threads[i],NULL);
+}
+
+static void numa_setup()
+{ static cpu_set_t ncpu[MAX_NODES];
+  int i, n;
+
+  if (NM_attr != NULL)
+    { for (i = 0; i < NM_nattr; i++)
+        pthread_attr_destroy(NM_attr+i);
+      free(NM_attr);
+      if (NM_hist != NULL)
+        munmap(NM_hist,NM_hsize);
+      NM_attr = NULL;
+      NM_hist = NULL;
+    }
+  if ( ! NUMA)
+    return;
+
+  for (n = 0; n < MAX_NODES; n++)
+    if ( ! node_cpus(n,ncpu+n))
+      break;
+  if (n <= 1)
+    { if (VERBOSE)
+        printf("\n   -N: only one NUMA node, threads are not pinned\n");
+      return;
+    }
+
+  NM_attr = (pthread_attr_t *) Malloc(sizeof(pthread_attr_t)*NTHREADS,"Allocating thread pins");
+  if (NM_attr == NULL)
+    Clean_Exit(1);
+  NM_nattr = NTHREADS;
+  for (i = 0; i < NTHREADS; i++)
+    { pthread_attr_init(NM_attr+i);
+      pthread_attr_setaffinity_np(NM_attr+i,sizeof(cpu_set_t),ncpu + (i*n)/NTHREADS);
+    }
+
+  if (VERBOSE)
+    printf("\n   -N: %d threads pinned across %d NUMA nodes\n",NTHREADS,n);
+}
+
+static double wall_clock()
+{ struct timeval t;
+
+  gettimeofday(&t,NULL);
+  return (t.tv_sec + 1e-6*t.tv_usec);
+}
+
+  //  Report the rate at which a phase starting at time start moved bytes to and from memory
+
+static void print_bandwidth(char *phase, double bytes, double start)
+{ double secs = wall_clock() - start;
+
+  printf("   %s: %.2fGb in %.2fs",phase,bytes/0x40000000ll,secs);
+  if (secs > 0.)
+    printf(" = %.2fGb/s",(bytes/0x40000000ll)/secs);
+  printf("\n");
+  fflush(stdout);
+}
+
+
+/*******************************************************************************************
+ *
+ *  LARGE ARRAYS (-L)
+ *
+ ********************************************************************************************/
+
+  //  The k-mer lists and seed-hit vectors are obtained with huge_alloc.  If HUGEPAGE is set,
+  //    one of at least HUGE_MIN bytes is mapped with explicit 1GB (if that big) or 2MB pages
+  //    when the system has them reserved, and otherwise with ordinary pages advised to be
+  //    backed by transparent huge pages.  Smaller arrays, or all if HUGEPAGE is not set, come
+  //    from the heap.  A header before the array records which, and the size of a mapping.
+
+#define HUGE_MIN   (32ll << 20)
+#define HUGE_HEAD  64             //  Keeps the array 64-byte aligned
+#define HUGE_2MB   (1ll << 21)
+#define HUGE_1GB   (1ll << 30)
+
+#define HG_HEAP  0
+#define HG_THP   1
+#define HG_2MB   2
+#define HG_1GB   3
+
+static char *HG_name[4] = { "heap", "transparent huge", "2MB", "1GB" };
+
+typedef struct
+  { int64 size;    //  Bytes mapped at the header (0 if from the heap)
+    int   kind;    //  HG_HEAP, HG_THP, HG_2MB, or HG_1GB
+  } Huge_Head;
+
+static void *huge_map(int64 bytes, int kind, int64 *size)
+{ char *p, *a;
+  int   flags;
+
+  flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  if (kind == HG_THP)
+    { *size = ((bytes + HUGE_2MB-1) / HUGE_2MB) * HUGE_2MB;
+      p = mmap(NULL,*size + HUGE_2MB,PROT_READ|PROT_WRITE,flags,-1,0);
+      if (p == MAP_FAILED)
+        return (NULL);
+      a = (char *) ((((uint64) p) + HUGE_2MB-1) & ~(HUGE_2MB-1));
+      if (a > p)
+        munmap(p,a-p);
+      munmap(a + *size,(p + HUGE_2MB) - a);
+      madvise(a,*size,MADV_HUGEPAGE);
+      return (a);
+    }
+
+#ifdef MAP_HUGETLB
+  if (kind == HG_1GB)
+    { *size = ((bytes + HUGE_1GB-1) / HUGE_1GB) * HUGE_1GB;
+#ifdef MAP_HUGE_SHIFT
+      flags |= MAP_HUGETLB | (30 << MAP_HUGE_SHIFT);
+#else
+      return (NULL);
+#endif
+    }
+  else
+    { *size = ((bytes + HUGE_2MB-1) / HUGE_2MB) * HUGE_2MB;
+#ifdef MAP_HUGE_SHIFT
+      flags |= MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+#else
+      flags |= MAP_HUGETLB;
+#endif
+    }
+  p = mmap(NULL,*size,PROT_READ|PROT_WRITE,flags,-1,0);
+  if (p == MAP_FAILED)
+    return (NULL);
+  return (p);
+#else
+  return (NULL);
+#endif
+}
+
+static void *huge_alloc(int64 bytes, char *mesg)
+{ Huge_Head *h;
+  int64      need, size;
+  int        kind;
+
+  need = bytes + HUGE_HEAD;
+  h    = NULL;
+  kind = HG_HEAP;
+  size = 0;
+  if (HUGEPAGE && need >= HUGE_MIN)
+    for (kind = (need >= HUGE_1GB ? HG_1GB : HG_2MB); kind > HG_HEAP; kind--)
+      if ((h = (Huge_Head *) huge_map(need,kind,&size)) != NULL)
+        break;
+
+  if (h == NULL)
+    { h = (Huge_Head *) Malloc(need,mesg);
+      if (h == NULL)
+        return (NULL);
+      size = 0;
+    }
+  h->size = size;
+  h->kind = kind;
+
+  if (VERBOSE && HUGEPAGE && need >= HUGE_MIN)
+    { printf("   %.2fGb array on %s pages\n",(1.*need)/0x40000000ll,HG_name[kind]);
+      fflush(stdout);
+    }
+
+  return (((char *) h) + HUGE_HEAD);
+}
+
+static void huge_free(void *array)
+{ Huge_Head *h;
+
+  if (array == NULL)
+    return;
+  h = (Huge_Head *) (((char *) array) - HUGE_HEAD);
+  if (h->kind == HG_HEAP)
+    free(h);
+  else
+    munmap(h,h->size);
+}
+
+  //  A mapped array is shrunk by unmapping the pages beyond its new end
+
+static void *huge_realloc(void *array, int64 bytes, char *mesg)
+{ Huge_Head *h;
+  int64      need, page, keep;
+  void      *new;
+
+  if (array == NULL)
+    return (huge_alloc(bytes,mesg));
+
+  h    = (Huge_Head *) (((char *) array) - HUGE_HEAD);
+  need = bytes + HUGE_HEAD;
+  if (h->kind == HG_HEAP)
+    { h = (Huge_Head *) Realloc(h,need,mesg);
+      if (h == NULL)
+        return (NULL);
+      return (((char *) h) + HUGE_HEAD);
+    }
+
+  if (need <= h->size)
+    { page = (h->kind == HG_1GB ? HUGE_1GB : HUGE_2MB);
+      keep = ((need + page-1) / page) * page;
+      if (keep < h->size)
+        { munmap(((char *) h) + keep,h->size - keep);
+          h->size = keep;
+        }
+      return (array);
+    }
+
+  new = huge_alloc(bytes,mesg);
+  if (new == NULL)
+    return (NULL);
+  memcpy(new,array,h->size - HUGE_HEAD);
+  huge_free(array);
+  return (new);
+}
+
 /*******************************************************************************************
  *
  *  LEXICOGRAPHIC SORT
@@ -168,13 +585,13 @@ int Set_Filter_Params(int kmer, int binshift, int suppress, int hitmin, int nthr
 #define BPOWR   256             //  = 2^BSHIFT
 #define BMASK  0xffllu          //  = BPOWR-1
 
-static uint64  QMASK;           //  = BMASK << NSHIFT
 static int     LEX_shift;
 static int64   LEX_zsize;
 static int     LEX_last;
 static int     LEX_next;
 static Double *LEX_src;
 static Double *LEX_trg;
+static int     LEX_packed;      //  Items are packed uint64 k-mers (see lex_packed_sort)
 
 typedef struct
   { int64  beg;
@@ -183,12 +600,33 @@ typedef struct
     int64 *sptr;
   } Lex_Arg;
 
+  //  Under -N thread i's sptr histogram is on a page of its node, otherwise NULL is returned
+  //    and the caller puts it on its stack
+
+static int64 *numa_histogram(int i)
+{ if (NM_attr == NULL)
+    return (NULL);
+  if (NM_hist == NULL)
+    { NM_hslot = ((NTHREADS*BPOWR*sizeof(int64) + PAGE_SIZE-1) / PAGE_SIZE) * (PAGE_SIZE/8);
+      NM_hsize = NM_hslot*sizeof(int64)*NTHREADS;
+      NM_hist  = (int64 *) mmap(NULL,NM_hsize,PROT_READ|PROT_WRITE,
+                                MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+      if (NM_hist == MAP_FAILED)
+        { fprintf(stderr,"%s: Could not allocate radix histograms\n",Prog_Name);
+          Clean_Exit(1);
+        }
+      numa_touch(NM_hist,NM_hsize);
+    }
+  return (NM_hist + i*NM_hslot);
+}
+
 static void *lex_thread(void *arg)
 { Lex_Arg    *data  = (Lex_Arg *) arg;
   int64      *sptr  = data->sptr;
   int64      *tptr  = data->tptr;
   int         shift = LEX_shift;   //  Must be a multiple of 8 in [0,120]
-  int        qshift = (LEX_next - LEX_shift) - NSHIFT;
+  int        qshift = (LEX_next - LEX_shift);
+  int         nthrd = NTHREADS;
   int64       zsize = LEX_zsize;
   Double     *src   = LEX_src;
   Double     *trg   = LEX_trg;
@@ -211,29 +649,20 @@ static void *lex_thread(void *arg)
             b = (c >> shift);
             x = tptr[b&BMASK]++;
             trg[x] = src[i];
-            sptr[((b >> qshift) & QMASK) + x/zsize] += 1;
+            sptr[((b >> qshift) & BMASK)*nthrd + x/zsize] += 1;
           }
     }
 
   else if ( ! LEX_last && LEX_next >= 64)   //  && LEX_shift < 64
 
-    { qshift = (LEX_next - 64) - NSHIFT;
-      if (qshift < 0)
-        for (i = data->beg; i < n; i++)
-          { c = src[i].p1;
-            b = (c >> shift);
-            x = tptr[b&BMASK]++;
-            trg[x] = src[i];
-            sptr[((src[i].p2 << NSHIFT) & QMASK) + x/zsize] += 1;
-          }
-      else
-        for (i = data->beg; i < n; i++)
-          { c = src[i].p1;
-            b = (c >> shift);
-            x = tptr[b&BMASK]++;
-            trg[x] = src[i];
-            sptr[((src[i].p2 >> qshift) & QMASK) + x/zsize] += 1;
-          }
+    { qshift = (LEX_next - 64);
+      for (i = data->beg; i < n; i++)
+        { c = src[i].p1;
+          b = (c >> shift);
+          x = tptr[b&BMASK]++;
+          trg[x] = src[i];
+          sptr[((src[i].p2 >> qshift) & BMASK)*nthrd + x/zsize] += 1;
+        }
     }
 
   else // LEX_last || LEX_next < 64
@@ -257,7 +686,7 @@ static void *lex_thread(void *arg)
           { c = src[i].p1;
             x = tptr[c&BMASK]++;
             trg[x] = src[i];
-            sptr[((c >> qshift) & QMASK) + x/zsize] += 1;
+            sptr[((c >> qshift) & BMASK)*nthrd + x/zsize] += 1;
           }
       else
         for (i = data->beg; i < n; i++)
@@ -265,12 +694,47 @@ static void *lex_thread(void *arg)
             b = (c >> shift);
             x = tptr[b&BMASK]++;
             trg[x] = src[i];
-            sptr[((b >> qshift) & QMASK) + x/zsize] += 1;
+            sptr[((b >> qshift) & BMASK)*nthrd + x/zsize] += 1;
           }
 
   return (NULL);
 }
 
+  //  The same for items that are a single uint64
+
+static void *lex_packed_thread(void *arg)
+{ Lex_Arg    *data  = (Lex_Arg *) arg;
+  int64      *sptr  = data->sptr;
+  int64      *tptr  = data->tptr;
+  int         shift = LEX_shift;   //  Must be a multiple of 8 in [0,56]
+  int        qshift = (LEX_next - LEX_shift);
+  int         nthrd = NTHREADS;
+  int64       zsize = LEX_zsize;
+  uint64     *src   = (uint64 *) LEX_src;
+  uint64     *trg   = (uint64 *) LEX_trg;
+  int64       i, n, x;
+  uint64      c, b;
+
+  n = data->end;
+  if (LEX_last)
+    for (i = data->beg; i < n; i++)
+      { c = src[i];
+        b = (c >> shift);
+        x = tptr[b&BMASK]++;
+        trg[x] = c;
+      }
+  else
+    for (i = data->beg; i < n; i++)
+      { c = src[i];
+        b = (c >> shift);
+        x = tptr[b&BMASK]++;
+        trg[x] = c;
+        sptr[((b >> qshift) & BMASK)*nthrd + x/zsize] += 1;
+      }
+
+  return (NULL);
+}
+
 static Double *lex_sort(int bytes[16], Double *src, Double *trg, Lex_Arg *parmx)
 { THREAD  threads[NTHREADS];
 
@@ -283,7 +747,6 @@ static Double *lex_sort(int bytes[16], Double *src, Double *trg, Lex_Arg *parmx)
   LEX_zsize = (len-1)/NTHREADS + 1;
   LEX_src   = src;
   LEX_trg   = trg;
-  QMASK     = (BMASK << NSHIFT);
 
   for (c = 0; c < 16; c++)
     if (bytes[c])
@@ -316,7 +779,7 @@ static Double *lex_sort(int bytes[16], Double *src, Double *trg, Lex_Arg *parmx)
           parmx[NTHREADS-1].end = len;
 
           for (j = 0; j < BPOWR; j++)
-            { k = (j << NSHIFT);
+            { k = j*NTHREADS;
               for (z = 0; z < NTHREADS; z++)
                 for (i = 0; i < NTHREADS; i++)
                   { parmx[i].tptr[j] += parmx[z].sptr[k+i];
@@ -333,8 +796,12 @@ static Double *lex_sort(int bytes[16], Double *src, Double *trg, Lex_Arg *parmx)
             x += y;
           }
 
-      for (i = 0; i < NTHREADS; i++)
-        pthread_create(threads+i,NULL,lex_thread,parmx+i);
+      if (LEX_packed)
+        for (i = 0; i < NTHREADS; i++)
+          pthread_create(threads+i,thread_attr(i),lex_packed_thread,parmx+i);
+      else
+        for (i = 0; i < NTHREADS; i++)
+          pthread_create(threads+i,thread_attr(i),lex_thread,parmx+i);
 
       for (i = 0; i < NTHREADS; i++)
         pthread_join(threads[i],NULL);
@@ -345,7 +812,9 @@ static Double *lex_sort(int bytes[16], Double *src, Double *trg, Lex_Arg *parmx)
 
 #ifdef TEST_LSORT
       printf("\nLSORT %d\n",LEX_shift);
-      if (LEX_shift >= 64)
+      if (LEX_packed)
+        ;
+      else if (LEX_shift >= 64)
         { x = (1 << ((LEX_shift-64)+BSHIFT))-1;
           for (i = 0; i < len; i++)
             { printf("%6d: %8llx %8llx %8llx %8llx : %4llx",
@@ -375,160 +844,663 @@ static Double *lex_sort(int bytes[16], Double *src, Double *trg, Lex_Arg *parmx)
   return (LEX_src);
 }
 
+  //  Sort packed k-mers on the bytes flagged in bytes[0..7]
+
+static uint64 *lex_packed_sort(int bytes[8], uint64 *src, uint64 *trg, Lex_Arg *parmx)
+{ int     wide[16];
+  uint64 *rez;
+  int     c;
+
+  for (c = 0; c < 8; c++)
+    { wide[c]   = bytes[c];
+      wide[c+8] = 0;
+    }
+  LEX_packed = 1;
+  rez = (uint64 *) lex_sort(wide,(Double *) src,(Double *) trg,parmx);
+  LEX_packed = 0;
+  return (rez);
+}
+
+
 
 /*******************************************************************************************
  *
- *  INDEX BUILD
+ *  IN-PLACE MSD RADIX SORT
+ *
+ *    An American-flag sort that permutes the array in place, so unlike lex_sort it needs no
+ *    second array of the same size.  The key is a sequence of "digits", each a byte of a
+ *    Double possibly complemented by a mask, most significant first.  As the sort is not
+ *    stable the caller appends tie-breaking digits that reproduce the order lex_sort would
+ *    have delivered.  The first digit is distributed serially after a threaded count, and
+ *    then threads claim the resulting buckets and sort them recursively.
  *
  ********************************************************************************************/
 
-static int *NormShift = NULL;
-static int  LogNorm, LogThresh;
-static int  LogBase[4];
-
-static DAZZ_DB    *TA_block;
-static KmerPos    *TA_list;
-static DAZZ_TRACK *TA_track;
+#define MSD_SMALL  32           //  Insertion sort buckets smaller than this
 
 typedef struct
-  { int    tnum;
-    int64 *kptr;
-    int    fill;
-  } Tuple_Arg;
-
-
-static void *tuple_thread(void *arg)
-{ Tuple_Arg  *data  = (Tuple_Arg *) arg;
-  int         tnum  = data->tnum;
-  int64      *kptr  = data->kptr;
-  KmerPos    *list  = TA_list;
-  int         i, m, n, x, p;
-  uint64      c;
-  char       *s;
+  { int    word;                //  Index of the uint64 within an item
+    int    shift;               //  Of the byte within the word
+    uint64 flip;                //  Xor'd with the byte before use
+  } Digit;
 
-  c  = TA_block->nreads;
-  i  = (c * tnum) >> NSHIFT;
-  n  = TA_block->reads[i].boff;
-  s  = ((char *) (TA_block->bases)) + n;
-  n -= Kmer*i;
+typedef struct
+  { int64   beg;
+    int64   end;
+    int64   count[BPOWR];
+  } Msd_Arg;
+
+static uint64 *MSD_array;
+static int     MSD_width;       //  Items are MSD_width uint64's (1 for packed k-mers, else 2)
+static Digit  *MSD_digit;
+static int     MSD_ndigit;
+static int64   MSD_bucket[BPOWR+1];
+static int     MSD_next;
+
+static inline int msd_byte(uint64 *x, Digit *d)
+{ return ((int) (((x[d->word] >> d->shift) ^ d->flip) & BMASK)); }
+
+static inline void msd_copy(uint64 *x, uint64 *y, int w)
+{ x[0] = y[0];
+  if (w > 1)
+    x[1] = y[1];
+}
 
-  if (TA_track != NULL)
-    { DAZZ_READ *reads = TA_block->reads;
-      int64     *anno1 = ((int64 *) (TA_track->anno)) + 1;
-      int       *point = (int *) (TA_track->data);
-      int64      a, b, f; 
-      int        q = 0;
+static void msd_small(uint64 *a, int64 n, Digit *dig, int ndig)
+{ int     w = MSD_width;
+  int64   i, j;
+  int     k, u, v;
+  uint64  x[2];
+
+  for (i = 1; i < n; i++)
+    { msd_copy(x,a+i*w,w);
+      for (j = i; j > 0; j--)
+        { for (k = 0; k < ndig; k++)
+            { u = msd_byte(a+(j-1)*w,dig+k);
+              v = msd_byte(x,dig+k);
+              if (u != v)
+                break;
+            }
+          if (k >= ndig || u < v)
+            break;
+          msd_copy(a+j*w,a+(j-1)*w,w);
+        }
+      msd_copy(a+j*w,x,w);
+    }
+}
 
-      f = anno1[i-1];
-      for (m = (c * (tnum+1)) >> NSHIFT; i < m; i++)
-        { b = f;
-          f = anno1[i];
-          for (a = b; a <= f; a += 2)
-            { if (a == b)
-                p = 0;
-              else
-                p = point[a-1];
-              if (a == f)
-                q = reads[i].rlen;
-              else
-                q = point[a];
-              if (p+Kmer <= q)
-                { c = 0;
-                  for (x = 1; x < Kmer; x++)
-                    c = (c << 2) | s[p++];
-                  while (p < q)
-                    { x = s[p];
-                      c = ((c << 2) | x) & Kmask;
-                      list[n].read = i;
-                      list[n].rpos = p++;
-                      list[n].code = c;
-                      n += 1;
-                      kptr[c & BMASK] += 1;
-                    }
-                }
+  //  Distribute a[0..n-1] into the BPOWR buckets of its leading digit, next[b] is the start
+  //    of bucket b on entry and last[b] its end
+
+static void msd_permute(uint64 *a, Digit *dig, int64 *next, int64 *last)
+{ int     w = MSD_width;
+  int64   y;
+  int     b, v;
+  uint64  x[2], z[2];
+
+  for (b = 0; b < BPOWR; b++)
+    { y = last[b];
+      while (next[b] < y)
+        { msd_copy(x,a+next[b]*w,w);
+          v = msd_byte(x,dig);
+          while (v != b)
+            { msd_copy(z,a+next[v]*w,w);
+              msd_copy(a+(next[v]++)*w,x,w);
+              msd_copy(x,z,w);
+              v = msd_byte(x,dig);
             }
-          s += (q+1);
+          msd_copy(a+(next[b]++)*w,x,w);
         }
+    }
+}
 
-      m = TA_block->reads[m].boff - Kmer*m;
-      kptr[BMASK] += (data->fill = m-n);
-      while (n < m)
-        { list[n].code = 0xffffffffffffffffllu;
-          list[n].read = -1;
-          list[n].rpos = -1;
-          n += 1;
+static void msd_bucket(uint64 *a, int64 n, Digit *dig, int ndig)
+{ int     w = MSD_width;
+  int64   count[BPOWR], next[BPOWR], last[BPOWR];
+  int64   i, y;
+  int     b;
+
+  while (ndig > 0)
+    { if (n < MSD_SMALL)
+        { msd_small(a,n,dig,ndig);
+          return;
         }
+
+      for (b = 0; b < BPOWR; b++)
+        count[b] = 0;
+      for (i = 0; i < n; i++)
+        count[msd_byte(a+i*w,dig)] += 1;
+      for (b = 0; b < BPOWR; b++)
+        if (count[b] != 0)
+          break;
+      if (count[b] < n)
+        break;
+      dig  += 1;                   //  All items have the same digit, go on to the next one
+      ndig -= 1;
+    }
+  if (ndig <= 0)
+    return;
+
+  y = 0;
+  for (b = 0; b < BPOWR; b++)
+    { next[b] = y;
+      y += count[b];
+      last[b] = y;
     }
 
-  else
-    for (m = (c * (tnum+1)) >> NSHIFT; i < m; i++)
-      { c = p = 0;
-        for (x = 1; x < Kmer; x++)
-          c = (c << 2) | s[p++];
-        while ((x = s[p]) != 4)
-          { c = ((c << 2) | x) & Kmask;
-            list[n].read = i;
-            list[n].rpos = p++;
-            list[n].code = c;
-            n += 1;
-            kptr[c & BMASK] += 1;
-          }
-        s += (p+1);
-      }
+  msd_permute(a,dig,next,last);
+
+  y = 0;
+  for (b = 0; b < BPOWR; b++)
+    { if (count[b] > 1)
+        msd_bucket(a+y*w,count[b],dig+1,ndig-1);
+      y += count[b];
+    }
+}
 
+static void *msd_count_thread(void *arg)
+{ Msd_Arg *data  = (Msd_Arg *) arg;
+  int64   *count = data->count;
+  uint64  *a     = MSD_array;
+  Digit   *dig   = MSD_digit;
+  int      w     = MSD_width;
+  int64    i;
+
+  for (i = 0; i < BPOWR; i++)
+    count[i] = 0;
+  for (i = data->beg; i < data->end; i++)
+    count[msd_byte(a+i*w,dig)] += 1;
   return (NULL);
 }
 
-static void *biased_tuple_thread(void *arg)
-{ Tuple_Arg  *data  = (Tuple_Arg *) arg;
-  int         tnum  = data->tnum;
-  int64      *kptr  = data->kptr;
-  KmerPos    *list  = TA_list;
-  int         n, i, m;
-  int         x, a, k, p;
-  uint64      d, c;
-  char       *s, *t;
+static void *msd_sort_thread(void *arg)
+{ int b;
 
-  c  = TA_block->nreads;
-  i  = (c * tnum) >> NSHIFT;
-  n  = TA_block->reads[i].boff;
-  s  = ((char *) (TA_block->bases)) + n;
-  n -= Kmer*i;
+  (void) arg;
+  while ((b = __sync_fetch_and_add(&MSD_next,1)) < BPOWR)
+    if (MSD_bucket[b+1] - MSD_bucket[b] > 1)
+      msd_bucket(MSD_array+MSD_bucket[b]*MSD_width,MSD_bucket[b+1]-MSD_bucket[b],
+                 MSD_digit+1,MSD_ndigit-1);
+  return (NULL);
+}
 
-  if (TA_track != NULL)
-    { DAZZ_READ *reads = TA_block->reads;
-      int64     *anno1 = ((int64 *) (TA_track->anno)) + 1;
-      int       *point = (int *) (TA_track->data);
-      int64      j, b, f; 
-      int        q = 0;
+  //  Sort the len items of width uint64's in a on the given digits
 
-      f = anno1[i-1];
-      for (m = (c * (tnum+1)) >> NSHIFT; i < m; i++)
-        { b = f;
-          f = anno1[i];
-          t = s+1;
-          for (j = b; j <= f; j += 2)
-            { if (j == b)
-                p = 0;
-              else
-                p = point[j-1];
-              if (j == f)
-                q = reads[i].rlen;
-              else
-                q = point[j];
-              if (p+Kmer <= q)
-                { c = 0;
-                  a = 0;
-                  k = 1;
-                  while (p < q)
-                    { x = s[p];
+static void msd_sort(Digit *dig, int ndig, uint64 *a, int width, int64 len)
+{ THREAD  threads[NTHREADS];
+  Msd_Arg parms[NTHREADS];
+  int64   next[BPOWR];
+  int64   y;
+  int     i, b;
+
+  if (len <= 1 || ndig <= 0)
+    return;
+
+  MSD_array  = a;
+  MSD_width  = width;
+  MSD_digit  = dig;
+  MSD_ndigit = ndig;
+
+  for (i = 0; i < NTHREADS; i++)
+    { parms[i].beg = (len * i) / NTHREADS;
+      parms[i].end = (len * (i+1)) / NTHREADS;
+    }
+
+  for (i = 0; i < NTHREADS; i++)
+    pthread_create(threads+i,thread_attr(i),msd_count_thread,parms+i);
+  for (i = 0; i < NTHREADS; i++)
+    pthread_join(threads[i],NULL);
+
+  y = 0;
+  for (b = 0; b < BPOWR; b++)
+    { MSD_bucket[b] = next[b] = y;
+      for (i = 0; i < NTHREADS; i++)
+        y += parms[i].count[b];
+    }
+  MSD_bucket[BPOWR] = len;
+
+  msd_permute(a,dig,next,MSD_bucket+1);
+
+  MSD_next = 0;
+  for (i = 0; i < NTHREADS; i++)
+    pthread_create(threads+i,thread_attr(i),msd_sort_thread,NULL);
+  for (i = 0; i < NTHREADS; i++)
+    pthread_join(threads[i],NULL);
+}
+
+  //  Set up the digits for sorting on the bytes flagged in bytes[16], most significant first,
+  //    followed by 'ntie' tie-breaking bytes tie[] with the given flips.  Return # of digits.
+
+static int msd_digits(Digit *dig, int bytes[16], int ntie, int *tie, int *flip)
+{ int c, n;
+
+  n = 0;
+  for (c = 15; c >= 0; c--)
+    if (bytes[c])
+      { dig[n].word  = (c >= 8);
+        dig[n].shift = (c & 0x7) << 3;
+        dig[n].flip  = 0;
+        n += 1;
+      }
+  for (c = 0; c < ntie; c++)
+    { dig[n].word  = (tie[c] >= 8);
+      dig[n].shift = (tie[c] & 0x7) << 3;
+      dig[n].flip  = flip[c];
+      n += 1;
+    }
+  return (n);
+}
+
+/*******************************************************************************************
+ *
+ *  INDEX BUILD
+ *
+ ********************************************************************************************/
+
+static int *NormShift = NULL;
+static int  LogNorm, LogThresh;
+static int  LogBase[4];
+
+static DAZZ_DB    *TA_block;
+static int         TA_comp;     //  Index the reverse complement of TA_block's reads?
+static KmerPos    *TA_list;
+static DAZZ_TRACK *TA_track;
+static uint16     *TA_freq;     //  DB-wide k-mer counts of 2^TA_fbits slots if KFREQ, else NULL
+static int         TA_fbits;
+
+  //  The .kfreq table of the DB of block is mapped once and kept for as long as the blocks
+  //    compared are from the same DB.  As -K was asked for, a missing or unsuitable table is
+  //    fatal.
+
+static char   *KF_name  = NULL;
+static void   *KF_base  = NULL;
+static int64   KF_size;
+static int64   KF_sig;        //  # of k-mers counted in the table (see kidx_header)
+
+static uint16 *load_kfreq(DAZZ_DB *block)
+{ Kfreq_Header *hdr;
+  struct stat   info;
+  char         *name;
+  int           fd;
+
+  name = KFREQ_NAME(block->path);
+  if (KF_name != NULL && strcmp(name,KF_name) == 0)
+    return ((uint16 *) (((char *) KF_base) + sizeof(Kfreq_Header)));
+
+  if (KF_base != NULL)
+    { munmap(KF_base,KF_size);
+      free(KF_name);
+    }
+  KF_name = Strdup(name,"Allocating frequency file name");
+  if (KF_name == NULL)
+    Clean_Exit(1);
+
+  fd = open(KF_name,O_RDONLY);
+  if (fd < 0)
+    { fprintf(stderr,"%s: Cannot open k-mer frequency table %s (made by DBkcount)\n",
+                     Prog_Name,KF_name);
+      Clean_Exit(1);
+    }
+  KF_base = MAP_FAILED;
+  if (fstat(fd,&info) == 0 && info.st_size > (off_t) sizeof(Kfreq_Header))
+    KF_base = mmap(NULL,info.st_size,PROT_READ,MAP_SHARED,fd,0);
+  close(fd);
+  if (KF_base == MAP_FAILED)
+    { fprintf(stderr,"%s: Cannot map k-mer frequency table %s\n",Prog_Name,KF_name);
+      KF_base = NULL;
+      Clean_Exit(1);
+    }
+  KF_size = info.st_size;
+
+  hdr = (Kfreq_Header *) KF_base;
+  if (memcmp(hdr->magic,KFREQ_MAGIC,8) != 0 || hdr->version != KFREQ_VERSION
+                                            || hdr->tbits != Kfreq_Bits(hdr->kmer)
+                                            || KF_size != (int64) (sizeof(Kfreq_Header)
+                                                           + sizeof(uint16)*(1ll << hdr->tbits)))
+    { fprintf(stderr,"%s: %s is not a valid k-mer frequency table\n",Prog_Name,KF_name);
+      Clean_Exit(1);
+    }
+  if (hdr->kmer != Kmer)
+    { fprintf(stderr,"%s: %s counts %d-mers, not %d-mers\n",Prog_Name,KF_name,hdr->kmer,Kmer);
+      Clean_Exit(1);
+    }
+  KF_sig = hdr->nkmers;
+
+  return ((uint16 *) (((char *) KF_base) + sizeof(Kfreq_Header)));
+}
+
+typedef struct
+  { int    tnum;
+    int64 *kptr;
+    int    fill;
+  } Tuple_Arg;
+
+
+  //  Invertible integer hash restricted to the 2*Kmer bits of a code, so that the minimizer
+  //    of a window is a pseudo-random rather than the lexicographically smallest k-mer.
+
+static inline uint64 kmer_hash(uint64 key)
+{ key = (~key + (key << 21)) & Kmask;
+  key = key ^ key >> 24;
+  key = ((key + (key << 3)) + (key << 8)) & Kmask;
+  key = key ^ key >> 14;
+  key = ((key + (key << 2)) + (key << 4)) & Kmask;
+  key = key ^ key >> 28;
+  key = (key + (key << 31)) & Kmask;
+  return (key);
+}
+
+  //  The k-mers list[beg..end) are consecutive in a read (or unmasked interval) and have been
+  //    counted in kptr.  Keep only the (WINDOW,Kmer)-minimizers, i.e. the k-mer of least hash
+  //    (leftmost if tied) in every window of WINDOW consecutive k-mers, compacting them to the
+  //    front of the range and correcting kptr.  Return the new end of the range.
+
+static int sample_kmers(KmerPos *list, int beg, int end, int64 *kptr)
+{ KmerPos ring[MAX_WINDOW];
+  uint64  hash[MAX_WINDOW];
+  int     w, len;
+  int     i, j, n, cur, last;
+
+  len = end-beg;
+  if (len <= 0)
+    return (end);
+  w = WINDOW;
+  if (w > len)
+    w = len;
+
+  for (i = beg; i < end; i++)
+    kptr[list[i].code & BMASK] -= 1;
+
+  cur = 0;
+  for (i = 0; i < w; i++)
+    { ring[i] = list[beg+i];
+      hash[i] = kmer_hash(ring[i].code >> CANONICAL);
+      if (hash[i] < hash[cur])
+        cur = i;
+    }
+
+  n = beg;
+  list[n++] = ring[cur];
+  kptr[ring[cur].code & BMASK] += 1;
+  last = cur;
+
+  for (j = w; j < len; j++)
+    { ring[j%w] = list[beg+j];
+      hash[j%w] = kmer_hash(ring[j%w].code >> CANONICAL);
+      if (cur <= j-w)
+        { cur = j-w+1;
+          for (i = cur+1; i <= j; i++)
+            if (hash[i%w] < hash[cur%w])
+              cur = i;
+        }
+      else if (hash[j%w] < hash[cur%w])
+        cur = j;
+      if (cur != last)
+        { list[n++] = ring[cur%w];
+          kptr[ring[cur%w].code & BMASK] += 1;
+          last = cur;
+        }
+    }
+
+  return (n);
+}
+
+  //  In CANONICAL mode the code of a k-mer c whose reverse complement is r is (c << 1) if
+  //    c <= r and (r << 1) | 1 otherwise, i.e. the lesser of the two and an orientation bit.
+
+static inline uint64 canon_code(uint64 c, uint64 r)
+{ if (c <= r)
+    return (c << 1);
+  else
+    return ((r << 1) | 1);
+}
+
+  //  The code of spaced seed j in window w
+
+static inline uint64 seed_code(uint64 w, int j)
+{ Seed_Code *sd = SD_code + j;
+  uint64     c;
+  int        k;
+
+  c = 0;
+  for (k = 0; k < sd->nrun; k++)
+    c |= ((w >> sd->rsh[k]) & sd->mask[k]) << sd->lsh[k];
+  return (c ^ sd->flip);
+}
+
+  //  As tuple_run below but for spaced seeds, listing the seed of each pattern at every
+  //    position.  The reverse complement of the window is rolled alongside it, as its seed
+  //    codes are the reverse complement codes of the window's seeds for CANONICAL.
+
+static int spaced_run(KmerPos *list, int n, int i, char *s, int p, int q, int comp,
+                      int64 *kptr)
+{ int     rsh = 2*Kspan-2;
+  int     j, k, o, x;
+  uint64  w, r, d;
+
+  o = n;
+  w = r = 0;
+  for (k = 1; k < Kspan; k++)
+    { x = comp ? 3-s[-p] : s[p];
+      w = (w << 2) | x;
+      r = (r >> 2) | (((uint64) (3-x)) << rsh);
+      p += 1;
+    }
+  for ( ; p < q; p++)
+    { x = comp ? 3-s[-p] : s[p];
+      w = ((w << 2) | x) & Wmask;
+      r = (r >> 2) | (((uint64) (3-x)) << rsh);
+      for (j = 0; j < NSEED; j++)
+        { d = seed_code(w,j);
+          if (CANONICAL)
+            d = canon_code(d,seed_code(r,j));
+          list[n].read = i;
+          list[n].rpos = p;
+          list[n].code = d;
+          n += 1;
+          kptr[d & BMASK] += 1;
+        }
+    }
+  if (WINDOW > 1)
+    n = sample_kmers(list,o,n,kptr);
+  return (n);
+}
+
+  //  Add to list[n..] the k-mers of read i that lie in [p,q) and return the new n.  If comp
+  //    then they are those of the reverse complement of the read, and s points at the last
+  //    base of the read rather than the first, so that its base at position p is 3-s[-p].
+
+static inline int tuple_run(KmerPos *list, int n, int i, char *s, int p, int q, int comp,
+                            int64 *kptr)
+{ uint16 *freq  = TA_freq;
+  int     fbits = TA_fbits;
+  int     rsh   = Kshift-2;
+  int     k, o, x;
+  uint64  c, r, d;
+
+  if (NSEED > 0)
+    return (spaced_run(list,n,i,s,p,q,comp,kptr));
+
+  o = n;
+  c = r = 0;
+  for (k = 1; k < Kmer; k++)
+    { x = comp ? 3-s[-p] : s[p];
+      c = (c << 2) | x;
+      r = (r >> 2) | (((uint64) (3-x)) << rsh);
+      p += 1;
+    }
+  while (p < q)
+    { x = comp ? 3-s[-p] : s[p];
+      c = ((c << 2) | x) & Kmask;
+      r = (r >> 2) | (((uint64) (3-x)) << rsh);
+      if (freq != NULL && freq[Kfreq_Slot(c,r,Kmer,fbits)] >= KFREQ)
+        { p += 1;
+          continue;
+        }
+      d = CANONICAL ? canon_code(c,r) : c;
+      list[n].read = i;
+      list[n].rpos = p++;
+      list[n].code = d;
+      n += 1;
+      kptr[d & BMASK] += 1;
+    }
+  if (WINDOW > 1)
+    n = sample_kmers(list,o,n,kptr);
+  return (n);
+}
+
+static void *tuple_thread(void *arg)
+{ Tuple_Arg  *data  = (Tuple_Arg *) arg;
+  int         tnum  = data->tnum;
+  int64      *kptr  = data->kptr;
+  KmerPos    *list  = TA_list;
+  DAZZ_READ  *reads = TA_block->reads;
+  int         i, m, n, p, q, len;
+  int64       c;
+  char       *s;
+
+  c  = TA_block->nreads;
+  i  = (c * tnum) / NTHREADS;
+  n  = reads[i].boff;
+  s  = ((char *) (TA_block->bases)) + n;
+  n  = Kper * (n - Kmer*i);
+
+  if (TA_track != NULL)
+
+    //  The unmasked intervals of a complemented read are those of the read reflected,
+    //    taken in reverse order so that its k-mers are listed by increasing position
+
+    { int64 *anno1 = ((int64 *) (TA_track->anno)) + 1;
+      int   *point = (int *) (TA_track->data);
+      int64  a, b, f;
+
+      f = anno1[i-1];
+      for (m = (c * (tnum+1)) / NTHREADS; i < m; i++)
+        { b = f;
+          f = anno1[i];
+          len = reads[i].rlen;
+          if (TA_comp)
+            for (a = b + ((f-b) & ~0x1ll); a >= b; a -= 2)
+              { p = (a == b ? 0 : point[a-1]);
+                q = (a == f ? len : point[a]);
+                if (p+Kspan <= q)
+                  n = tuple_run(list,n,i,s+(len-1),len-q,len-p,1,kptr);
+              }
+          else
+            for (a = b; a <= f; a += 2)
+              { p = (a == b ? 0 : point[a-1]);
+                q = (a == f ? len : point[a]);
+                if (p+Kspan <= q)
+                  n = tuple_run(list,n,i,s,p,q,0,kptr);
+              }
+          s += (len+1);
+        }
+    }
+
+  else if (TA_comp)
+    for (m = (c * (tnum+1)) / NTHREADS; i < m; i++)
+      { len = reads[i].rlen;
+        n = tuple_run(list,n,i,s+(len-1),0,len,1,kptr);
+        s += (len+1);
+      }
+
+  else
+    for (m = (c * (tnum+1)) / NTHREADS; i < m; i++)
+      { len = reads[i].rlen;
+        n = tuple_run(list,n,i,s,0,len,0,kptr);
+        s += (len+1);
+      }
+
+  m = Kper * (reads[m].boff - Kmer*m);
+  kptr[BMASK] += (data->fill = m-n);
+  while (n < m)
+    { list[n].code = 0xffffffffffffffffllu;
+      list[n].read = -1;
+      list[n].rpos = -1;
+      n += 1;
+    }
+
+  return (NULL);
+}
+
+  //  Set buf[1..len] to the reverse complement of the len bases at s, delimited by 4's as
+  //    in a block, and return buf+1
+
+static char *complement_read(char *buf, char *s, int len)
+{ int i;
+
+  buf[0] = 4;
+  for (i = 0; i < len; i++)
+    buf[len-i] = (char) (3-s[i]);
+  buf[len+1] = 4;
+  return (buf+1);
+}
+
+  //  -b is rarely used, so the complement of a read is made in a scratch buffer rather than
+  //    read in place as in tuple_thread
+
+static void *biased_tuple_thread(void *arg)
+{ Tuple_Arg  *data  = (Tuple_Arg *) arg;
+  int         tnum  = data->tnum;
+  int64      *kptr  = data->kptr;
+  KmerPos    *list  = TA_list;
+  int         n, i, m, o;
+  int         x, a, k, p;
+  uint64      d, c;
+  char       *s, *t, *u;
+  char       *cbuf;
+
+  cbuf = NULL;
+  if (TA_comp)
+    { cbuf = (char *) Malloc(TA_block->maxlen+2,"Allocating complement buffer");
+      if (cbuf == NULL)
+        Clean_Exit(1);
+    }
+
+  c  = TA_block->nreads;
+  i  = (c * tnum) / NTHREADS;
+  n  = TA_block->reads[i].boff;
+  s  = ((char *) (TA_block->bases)) + n;
+  n -= Kmer*i;
+
+  if (TA_track != NULL)
+    { DAZZ_READ *reads = TA_block->reads;
+      int64     *anno1 = ((int64 *) (TA_track->anno)) + 1;
+      int       *point = (int *) (TA_track->data);
+      int64      j, h, b, f, e;
+      int        q, len;
+
+      f = anno1[i-1];
+      for (m = (c * (tnum+1)) / NTHREADS; i < m; i++)
+        { b = f;
+          f = anno1[i];
+          e = b + ((f-b) & ~0x1ll);
+          len = reads[i].rlen;
+          u = TA_comp ? complement_read(cbuf,s,len) : s;
+          t = u+1;
+          for (j = b; j <= f; j += 2)
+            { h = TA_comp ? e - (j-b) : j;
+              p = (h == b ? 0 : point[h-1]);
+              q = (h == f ? len : point[h]);
+              if (TA_comp)
+                { x = p;
+                  p = len-q;
+                  q = len-x;
+                }
+              if (p+Kmer <= q)
+                { c = 0;
+                  a = 0;
+                  k = 1;
+                  o = n;
+                  while (p < q)
+                    { x = u[p];
                       a += LogBase[x];
                       c  = ((c << 2) | x);
                       while (a < LogNorm && k < Kmer)
                         { if (++p >= q)
                             break;
                           k += 1;
-                          x  = s[p];
+                          x  = u[p];
                           a += LogBase[x];
                           c  = ((c << 2) | x);
                         }
@@ -547,25 +1519,29 @@ static void *biased_tuple_thread(void *arg)
                           kptr[d & BMASK] += 1;
                         }
                       p += 1;
-                      a -= LogBase[(int) s[p-k]];
+                      a -= LogBase[(int) u[p-k]];
                     }
+                  if (WINDOW > 1)
+                    n = sample_kmers(list,o,n,kptr);
                 }
             }
-          s += (q+1);
+          s += (len+1);
 	}
     }
 
   else
-    for (m = (c * (tnum+1)) >> NSHIFT; i < m; i++)
-      { t = s+1;
+    for (m = (c * (tnum+1)) / NTHREADS; i < m; i++)
+      { u = TA_comp ? complement_read(cbuf,s,TA_block->reads[i].rlen) : s;
+        t = u+1;
         c = 0;
         p = a = 0;
         k = 1;
-        while ((x = s[p]) != 4)
+        o = n;
+        while ((x = u[p]) != 4)
           { a += LogBase[x];
             c  = ((c << 2) | x);
             while (a < LogNorm && k < Kmer)
-              { if ((x = s[++p]) == 4)
+              { if ((x = u[++p]) == 4)
                   goto eoread2;
                 k += 1;
                 a += LogBase[x];
@@ -586,9 +1562,11 @@ static void *biased_tuple_thread(void *arg)
                 kptr[d & BMASK] += 1;
               }
             p += 1;
-            a -= LogBase[(int) s[p-k]];
+            a -= LogBase[(int) u[p-k]];
           }
       eoread2:
+        if (WINDOW > 1)
+          n = sample_kmers(list,o,n,kptr);
         s += (p+1);
       }
 
@@ -601,6 +1579,7 @@ static void *biased_tuple_thread(void *arg)
       n += 1;
     }
 
+  free(cbuf);
   return (NULL);
 }
 
@@ -608,9 +1587,10 @@ static KmerPos *FR_src;
 static KmerPos *FR_trg;
 
 typedef struct
-  { int  beg;
-    int  end;
-    int  kept;
+  { int    beg;
+    int    end;
+    int    kept;
+    uint64 stop;    //  Code of the entry at end, taken before any thread compacts in place
   } Comp_Arg;
 
 static void *compsize_thread(void *arg)
@@ -641,6 +1621,7 @@ static void *compress_thread(void *arg)
   int         end   = data->end;
   KmerPos    *src   = FR_src;
   KmerPos    *trg   = FR_trg;
+  uint64      stop  = data->stop;
   int         n, i, p;
   uint64      h, g;
 
@@ -649,7 +1630,7 @@ static void *compress_thread(void *arg)
   n = data->kept;
   while (i < end)
     { p = i++;
-      while ((g = src[i].code) == h)
+      while ((g = (i < end ? src[i].code : stop)) == h)
         i += 1;
       if (i-p < TooFrequent)
         { while (p < i)
@@ -661,102 +1642,398 @@ static void *compress_thread(void *arg)
   return (NULL);
 }
 
-void *Sort_Kmers(DAZZ_DB *block, int *len)
-{ THREAD    threads[NTHREADS];
-  Tuple_Arg parmt[NTHREADS];
-  Comp_Arg  parmf[NTHREADS];
-  Lex_Arg   parmx[NTHREADS];
-  int       mersort[16];
+  //  Packed k-mer lists: the threaded counterparts of compsize/compress_thread above and the
+  //    packing of each thread's segment of a KmerPos list
 
-  KmerPos  *src, *trg, *rez;
-  int       kmers, nreads;
-  int       i, j, x, z;
-  uint64    h;
+static uint64 *FP_src;
+static uint64 *FP_trg;
 
-  for (i = 0; i < NTHREADS; i++)
-    parmx[i].sptr = (int64 *) alloca(NTHREADS*BPOWR*sizeof(int64));
+static void *compsize_packed_thread(void *arg)
+{ Comp_Arg   *data  = (Comp_Arg *) arg;
+  int         end   = data->end;
+  uint64     *src   = FP_src;
+  int         n, i, c, p;
+  uint64      h, g;
 
-  for (i = 0; i < 16; i++)
-    mersort[i] = 0;
-  for (i = 0; i < Kshift; i += 8)
-    mersort[i>>3] = 1;
+  i = data->beg;
+  h = PK_CODE(src[i]);
+  n = 0;
+  while (i < end)
+    { p = i++;
+      while ((g = PK_CODE(src[i])) == h)
+        i += 1;
+      if ((c = (i-p)) < TooFrequent)
+        n += c;
+      h = g;
+    }
 
-  if (NormShift == NULL && BIASED)
-    { double scale;
+  data->kept = n;
+  return (NULL);
+}
 
-      NormShift = (int *) Malloc(sizeof(int)*(Kmer+1),"Allocating Sort_Kmers bias shift");
-      if (NormShift == NULL)
-        Clean_Exit(1);
-      for (i = 0; i <= Kmer; i++)
-        NormShift[i] = Kshift - 2*i;
-      LogNorm = 10000 * Kmer;
-      LogThresh = 10000 * (Kmer-MAX_BIAS);
+static void *compress_packed_thread(void *arg)
+{ Comp_Arg   *data  = (Comp_Arg *) arg;
+  int         end   = data->end;
+  uint64     *src   = FP_src;
+  uint64     *trg   = FP_trg;
+  uint64      stop  = data->stop;
+  int         n, i, p;
+  uint64      h, g;
 
-      scale = -10000. / log(4.);
-      for (i = 0; i < 4; i++)
-        LogBase[i] = (int) ceil( scale * log(block->freq[i]) );
+  i = data->beg;
+  h = PK_CODE(src[i]);
+  n = data->kept;
+  while (i < end)
+    { p = i++;
+      while ((g = (i < end ? PK_CODE(src[i]) : stop)) == h)
+        i += 1;
+      if (i-p < TooFrequent)
+        { while (p < i)
+            trg[n++] = src[p++];
+        }
+      h = g;
     }
 
-  nreads = block->nreads;
-  kmers  = block->reads[nreads].boff - Kmer * nreads;
+  return (NULL);
+}
 
-  if (block->reads[nreads].boff > 0x7fffffffll)
-    { fprintf(stderr,"%s: Fatal error, DB blocks are greater than 2Gbp!\n",Prog_Name);
-      Clean_Exit(1);
+typedef struct
+  { int    beg;
+    int    end;
+    int    rshift;
+    int    pbyte;         //  Byte of the packed word on which the first sort pass is made
+    int64 *kptr;
+  } Pack_Arg;
+
+  //  Pack the KmerPos entries [beg,end) of FP_src (viewed as KmerPos) into the first half of
+  //    the same segment and histogram the bytes the first radix pass will sort on.  Padding
+  //    entries (read < 0) get all-ones below the top bit so they sort after every real k-mer.
+
+static void *pack_thread(void *arg)
+{ Pack_Arg *data   = (Pack_Arg *) arg;
+  KmerPos  *src    = (KmerPos *) FP_src;
+  int64    *kptr   = data->kptr;
+  int       rshift = data->rshift;
+  int       pshift = (data->pbyte << 3);
+  uint64   *trg;
+  uint64    v;
+  int       i, n;
+
+  trg = (uint64 *) (src + data->beg);
+  n   = 0;
+  for (i = data->beg; i < data->end; i++)
+    { if (src[i].read < 0)
+        v = 0x7fffffffffffffffllu;
+      else
+        v = (src[i].code << PK_shift) | (((uint64) src[i].read) << rshift) | src[i].rpos;
+      trg[n++] = v;
+      kptr[(v >> pshift) & BMASK] += 1;
     }
 
-  if (kmers <= 0)
-    goto no_mers;
+  return (NULL);
+}
 
-  if (( (Kshift-1)/BSHIFT + (TooFrequent < INT32_MAX) ) & 0x1)
-    { trg = (KmerPos *) Malloc(sizeof(KmerPos)*(kmers+2),"Allocating Sort_Kmers vectors");
-      src = (KmerPos *) Malloc(sizeof(KmerPos)*(kmers+2),"Allocating Sort_Kmers vectors");
-    }
-  else
-    { src = (KmerPos *) Malloc(sizeof(KmerPos)*(kmers+2),"Allocating Sort_Kmers vectors");
-      trg = (KmerPos *) Malloc(sizeof(KmerPos)*(kmers+2),"Allocating Sort_Kmers vectors");
-    }
-  if (src == NULL || trg == NULL)
-    Clean_Exit(1);
+  //  Return the # of bits for rpos if the k-mers of block can be packed, 0 otherwise
 
-  if (VERBOSE)
-    { printf("\n   Kmer count = ");
-      Print_Number((int64) kmers,0,stdout);
-      printf("\n   Using %.2fGb of space\n",(1. * kmers) / 33554432);
-      fflush(stdout);
-    }
+static int kmer_layout(DAZZ_DB *block, int *rmask)
+{ int rbits, pbits;
 
-  TA_block = block;
-  TA_list  = src;
-  TA_track = block->tracks;
+  *rmask = 0;
+  if (Kbits >= 63)
+    return (0);
 
-  for (i = 0; i < NTHREADS; i++)
-    { parmt[i].tnum = i;
-      parmt[i].kptr = parmx[i].tptr;
-      for (j = 0; j < BPOWR; j++)
-        parmt[i].kptr[j] = 0;
-    }
+  for (rbits = 0; (1ll << rbits) <= block->nreads; rbits++)   //  all-ones is not a read
+    ;
+  for (pbits = 1; (1ll << pbits) < block->maxlen; pbits++)
+    ;
+  if (Kbits + 1 + rbits + pbits > 64)
+    return (0);
+
+  *rmask = (int) ((1ll << rbits) - 1);
+  return (pbits);
+}
+
+  //  Pack the kmers entries of src produced by the tuple threads (whose segments are given
+  //    in parmx), sort them, and remove the padding and any overly frequent k-mers.  Src is
+  //    shrunk or freed in the process.  Returns the sorted list and its length in *kmers.
+
+static uint64 *sort_packed(KmerPos *src, int *kmers, Tuple_Arg *parmt, Lex_Arg *parmx,
+                           int rshift)
+{ THREAD    threads[NTHREADS];
+  Pack_Arg  parmp[NTHREADS];
+  Comp_Arg  parmf[NTHREADS];
+  int       keep[NTHREADS];
+  int       mersort[16];
+  uint64   *list, *trg, *rez;
+  int       i, j, x, n, fb;
+
+  n  = *kmers;
+  fb = (PK_shift >> 3);
+  for (i = 0; i < 16; i++)
+    mersort[i] = (i >= fb && i < 8);
+
+  FP_src = (uint64 *) src;
+  for (i = 0; i < NTHREADS; i++)
+    { parmp[i].beg    = parmx[i].beg;
+      parmp[i].end    = parmx[i].end;
+      parmp[i].rshift = rshift;
+      parmp[i].pbyte  = fb;
+      parmp[i].kptr   = parmx[i].tptr;
+      for (j = 0; j < BPOWR; j++)
+        parmp[i].kptr[j] = 0;
+    }
+
+  for (i = 0; i < NTHREADS; i++)
+    pthread_create(threads+i,thread_attr(i),pack_thread,parmp+i);
+
+  for (i = 0; i < NTHREADS; i++)
+    pthread_join(threads[i],NULL);
+
+  list = (uint64 *) src;
+  for (i = 1; i < NTHREADS; i++)
+    memmove(list+parmp[i].beg,src+parmp[i].beg,
+            (parmp[i].end-parmp[i].beg)*sizeof(uint64));
+  list = (uint64 *) huge_realloc(src,sizeof(uint64)*(n+2),"Shrinking Sort_Kmers vector");
+  if (list == NULL)
+    Clean_Exit(1);
+
+  if (INPLACE)
+    { static int tie[8]  = { 7, 6, 5, 4, 3, 2, 1, 0 };
+      static int flip[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+      Digit digit[16];
+      int   ndig;
+
+      ndig = msd_digits(digit,mersort,fb,tie+(8-fb),flip);
+      msd_sort(digit,ndig,list,1,(int64) n);
+      rez = list;
+      trg = NULL;
+    }
+  else
+    { trg = (uint64 *) huge_alloc(sizeof(uint64)*(n+2),"Allocating Sort_Kmers vectors");
+      if (trg == NULL)
+        Clean_Exit(1);
+      numa_touch(trg,sizeof(uint64)*(n+2));
+      rez = lex_packed_sort(mersort,list,trg,parmx);
+    }
+
+  if (BIASED || TA_track != NULL || TA_freq != NULL || WINDOW > 1)
+    for (i = 0; i < NTHREADS; i++)
+      n -= parmt[i].fill;
+
+  if (TooFrequent < INT32_MAX && n > 0)
+    { parmf[0].beg = 0;
+      for (i = 1; i < NTHREADS; i++)
+        { x = (((int64) i)*n) / NTHREADS;
+          while (PK_CODE(rez[x]) == PK_CODE(rez[x-1]))
+            x += 1;
+          parmf[i-1].end = parmf[i].beg = x;
+        }
+      parmf[NTHREADS-1].end = n;
+
+      rez[n] = 0xffffffffffffffffllu;
+
+      for (i = 0; i < NTHREADS; i++)
+        parmf[i].stop = PK_CODE(rez[parmf[i].end]);
+
+      FP_src = rez;
+      if (INPLACE)
+        FP_trg = rez;
+      else
+        FP_trg = rez = (rez == list ? trg : list);
+
+      for (i = 0; i < NTHREADS; i++)
+        pthread_create(threads+i,thread_attr(i),compsize_packed_thread,parmf+i);
+
+      for (i = 0; i < NTHREADS; i++)
+        pthread_join(threads[i],NULL);
+
+      x = 0;
+      for (i = 0; i < NTHREADS; i++)
+        { keep[i] = parmf[i].kept;
+          if (INPLACE)
+            parmf[i].kept = parmf[i].beg;
+          else
+            parmf[i].kept = x;
+          x += keep[i];
+        }
+      n = x;
+
+      for (i = 0; i < NTHREADS; i++)
+        pthread_create(threads+i,thread_attr(i),compress_packed_thread,parmf+i);
+
+      for (i = 0; i < NTHREADS; i++)
+        pthread_join(threads[i],NULL);
+
+      if (INPLACE)
+        { x = 0;
+          for (i = 0; i < NTHREADS; i++)
+            { if (x < parmf[i].beg)
+                memmove(rez+x,rez+parmf[i].beg,keep[i]*sizeof(uint64));
+              x += keep[i];
+            }
+        }
+    }
+
+  rez[n]   = 0xffffffffffffffffllu;
+  rez[n+1] = 0;
+
+  if (rez == list)
+    huge_free(trg);
+  else
+    huge_free(list);
+
+  *kmers = n;
+  return (rez);
+}
+
+void *Sort_Kmers(DAZZ_DB *block, int comp, int *len)
+{ THREAD    threads[NTHREADS];
+  Tuple_Arg parmt[NTHREADS];
+  Comp_Arg  parmf[NTHREADS];
+  Lex_Arg   parmx[NTHREADS];
+  int       mersort[16];
+  int       keep[NTHREADS];
+
+  KmerPos  *src, *trg, *rez;
+  int       kmers, nreads;
+  int       rshift, rmask;
+  int       i, j, x, z;
+  uint64    h;
+  double    start, bytes;  //  Phase start time and traffic for the bandwidth reported if VERBOSE
+
+  for (i = 0; i < NTHREADS; i++)
+    if ((parmx[i].sptr = numa_histogram(i)) == NULL)
+      parmx[i].sptr = (int64 *) alloca(NTHREADS*BPOWR*sizeof(int64));
+
+  for (i = 0; i < 16; i++)
+    mersort[i] = 0;
+  for (i = 0; i < Kbits; i += 8)
+    mersort[i>>3] = 1;
+
+  if (NormShift == NULL && BIASED)
+    { double scale;
+
+      NormShift = (int *) Malloc(sizeof(int)*(Kmer+1),"Allocating Sort_Kmers bias shift");
+      if (NormShift == NULL)
+        Clean_Exit(1);
+      for (i = 0; i <= Kmer; i++)
+        NormShift[i] = Kshift - 2*i;
+      LogNorm = 10000 * Kmer;
+      LogThresh = 10000 * (Kmer-MAX_BIAS);
+
+      scale = -10000. / log(4.);
+      for (i = 0; i < 4; i++)
+        LogBase[i] = (int) ceil( scale * log(block->freq[i]) );
+    }
+
+  nreads = block->nreads;
+  kmers  = Kper * (block->reads[nreads].boff - Kmer * nreads);
+
+  if (block->reads[nreads].boff > 0x7fffffffll)
+    { fprintf(stderr,"%s: Fatal error, DB blocks are greater than 2Gbp!\n",Prog_Name);
+      Clean_Exit(1);
+    }
+  if (Kper * (block->reads[nreads].boff - Kmer * nreads) > 0x7fffffffll)
+    { fprintf(stderr,"%s: Fatal error, %d seed patterns give > 2G seeds in a block!\n",
+                     Prog_Name,Kper);
+      Clean_Exit(1);
+    }
+
+  if (kmers <= 0)
+    goto no_mers;
+
+  rshift = kmer_layout(block,&rmask);
+
+  if (INPLACE || rshift > 0)
+    { src = (KmerPos *) huge_alloc(sizeof(KmerPos)*(kmers+2),"Allocating Sort_Kmers vector");
+      trg = NULL;
+      if (src == NULL)
+        Clean_Exit(1);
+    }
+  else
+    { if (( (Kbits-1)/BSHIFT + (TooFrequent < INT32_MAX) ) & 0x1)
+        { trg = (KmerPos *) huge_alloc(sizeof(KmerPos)*(kmers+2),"Allocating Sort_Kmers vectors");
+          src = (KmerPos *) huge_alloc(sizeof(KmerPos)*(kmers+2),"Allocating Sort_Kmers vectors");
+        }
+      else
+        { src = (KmerPos *) huge_alloc(sizeof(KmerPos)*(kmers+2),"Allocating Sort_Kmers vectors");
+          trg = (KmerPos *) huge_alloc(sizeof(KmerPos)*(kmers+2),"Allocating Sort_Kmers vectors");
+        }
+      if (src == NULL || trg == NULL)
+        Clean_Exit(1);
+    }
+  numa_touch(src,sizeof(KmerPos)*(kmers+2));
+  numa_touch(trg,sizeof(KmerPos)*(kmers+2));
+
+  if (VERBOSE)
+    { printf("\n   Kmer count = ");
+      Print_Number((int64) kmers,0,stdout);
+      printf("\n   Using %.2fGb of space\n",(1. * kmers) / ((INPLACE || rshift > 0) ? 67108864 : 33554432));
+      fflush(stdout);
+    }
+
+  TA_block = block;
+  TA_comp  = comp;
+  TA_list  = src;
+  TA_track = block->tracks;
+  TA_freq  = (KFREQ > 0) ? load_kfreq(block) : NULL;
+  TA_fbits = Kfreq_Bits(Kmer);
+
+  for (i = 0; i < NTHREADS; i++)
+    { parmt[i].tnum = i;
+      parmt[i].kptr = parmx[i].tptr;
+      for (j = 0; j < BPOWR; j++)
+        parmt[i].kptr[j] = 0;
+    }
+
+  start = wall_clock();
 
   if (BIASED)
     for (i = 0; i < NTHREADS; i++)
-      pthread_create(threads+i,NULL,biased_tuple_thread,parmt+i);
+      pthread_create(threads+i,thread_attr(i),biased_tuple_thread,parmt+i);
   else
     for (i = 0; i < NTHREADS; i++)
-      pthread_create(threads+i,NULL,tuple_thread,parmt+i);
+      pthread_create(threads+i,thread_attr(i),tuple_thread,parmt+i);
 
   for (i = 0; i < NTHREADS; i++)
     pthread_join(threads[i],NULL);
 
+  if (VERBOSE)
+    print_bandwidth("K-mer list",(double) block->reads[nreads].boff + 16.*kmers,start);
+  start = wall_clock();
+  bytes = 2. * ((Kbits+7) >> 3) * kmers * (rshift > 0 ? 8 : 16);
+
   x = 0;
   for (i = 0; i < NTHREADS; i++)
     { parmx[i].beg = x;
-      j = (int) ((((int64) nreads) * (i+1)) >> NSHIFT);
-      parmx[i].end = x = block->reads[j].boff - j*Kmer;
+      j = (int) ((((int64) nreads) * (i+1)) / NTHREADS);
+      parmx[i].end = x = Kper * (block->reads[j].boff - j*Kmer);
+    }
+
+  if (rshift > 0)
+    { rez = (KmerPos *) sort_packed(src,&kmers,parmt,parmx,rshift);
+      goto sorted;
     }
 
-  rez = (KmerPos *) lex_sort(mersort,(Double *) src,(Double *) trg,parmx);
-  if (BIASED || TA_track != NULL)
-    { if (Kmer%4 == 0)
+  if (INPLACE)
+
+    //  Ties are broken on read and then rpos, the order in which the tuple threads emitted
+    //    them and hence the order the stable LSD sort delivers.  Padding entries have read -1
+    //    and so fall after all real k-mers with the same code, making the wedge fix-up moot.
+
+    { static int tie[8]  = { 15, 14, 13, 12, 11, 10, 9, 8 };
+      static int flip[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+      Digit digit[24];
+      int   ndig;
+
+      ndig = msd_digits(digit,mersort,8,tie,flip);
+      msd_sort(digit,ndig,(uint64 *) src,2,(int64) kmers);
+      rez = src;
+    }
+  else
+    rez = (KmerPos *) lex_sort(mersort,(Double *) src,(Double *) trg,parmx);
+  if (BIASED || TA_track != NULL || TA_freq != NULL || WINDOW > 1)
+    { if (Kbits%8 == 0 && ! INPLACE)
         { int wedge[NTHREADS];
 
           for (j = 0; j < NTHREADS; j++)
@@ -788,7 +2065,7 @@ void *Sort_Kmers(DAZZ_DB *block, int *len)
   if (TooFrequent < INT32_MAX && kmers > 0)
     { parmf[0].beg = 0;
       for (i = 1; i < NTHREADS; i++)
-        { x = (((int64) i)*kmers) >> NSHIFT;
+        { x = (((int64) i)*kmers) / NTHREADS;
           h = rez[x-1].code;
           while (rez[x].code == h)
             x += 1;
@@ -801,7 +2078,12 @@ void *Sort_Kmers(DAZZ_DB *block, int *len)
       else
         rez[kmers].code = 0xffffffffffffffffllu;
 
-      if (src == rez)
+      for (i = 0; i < NTHREADS; i++)
+        parmf[i].stop = rez[parmf[i].end].code;
+
+      if (INPLACE)
+        FR_src = FR_trg = rez;
+      else if (src == rez)
         { FR_src = src;
           FR_trg = rez = trg;
         }
@@ -811,35 +2093,56 @@ void *Sort_Kmers(DAZZ_DB *block, int *len)
         }
 
       for (i = 0; i < NTHREADS; i++)
-        pthread_create(threads+i,NULL,compsize_thread,parmf+i);
+        pthread_create(threads+i,thread_attr(i),compsize_thread,parmf+i);
 
       for (i = 0; i < NTHREADS; i++)
         pthread_join(threads[i],NULL);
 
+      //  In place, each thread compacts within its own segment and the segments are then
+      //    slid down serially.  A thread may overwrite the first entry of the next segment,
+      //    so its left neighbor ends its last run on the copy of that entry's code in stop.
+
       x = 0;
       for (i = 0; i < NTHREADS; i++)
-        { z = parmf[i].kept;
-          parmf[i].kept = x;
-          x += z;
+        { keep[i] = parmf[i].kept;
+          if (INPLACE)
+            parmf[i].kept = parmf[i].beg;
+          else
+            parmf[i].kept = x;
+          x += keep[i];
         }
       kmers = x;
 
       for (i = 0; i < NTHREADS; i++)
-        pthread_create(threads+i,NULL,compress_thread,parmf+i);
+        pthread_create(threads+i,thread_attr(i),compress_thread,parmf+i);
 
       for (i = 0; i < NTHREADS; i++)
         pthread_join(threads[i],NULL);
+
+      if (INPLACE)
+        { x = 0;
+          for (i = 0; i < NTHREADS; i++)
+            { if (x < parmf[i].beg)
+                memmove(rez+x,rez+parmf[i].beg,keep[i]*sizeof(KmerPos));
+              x += keep[i];
+            }
+        }
     }
 
   rez[kmers].code   = 0xffffffffffffffffllu;
   rez[kmers+1].code = 0;
     
   if (src != rez)
-    free(src);
+    huge_free(src);
   else
-    free(trg);
+    huge_free(trg);
+
+sorted:
+  if (VERBOSE)
+    print_bandwidth("K-mer sort",bytes,start);
 
 #ifdef TEST_KSORT
+  if (rshift == 0)
   { int i;
 
     printf("\nKMER SORT:\n");
@@ -852,21 +2155,22 @@ void *Sort_Kmers(DAZZ_DB *block, int *len)
 #endif
 
   if (VERBOSE)
-    { if (TooFrequent < INT32_MAX || BIASED || TA_track != NULL)
+    { if (TooFrequent < INT32_MAX || BIASED || TA_track != NULL || TA_freq != NULL
+                                 || WINDOW > 1)
         { printf("   Revised kmer count = ");
           Print_Number((int64) kmers,0,stdout);
           printf("\n");
         }
-      printf("   Index occupies %.2fGb\n",(1. * kmers) / 67108864);
+      printf("   Index occupies %.2fGb\n",(1. * kmers) / (rshift > 0 ? 134217728 : 67108864));
       fflush(stdout);
     }
 
   if (kmers <= 0)
-    { free(rez);
+    { huge_free(rez);
       goto no_mers;
     }
 
-  if (kmers > (int64) (MEM_LIMIT/(4*sizeof(KmerPos))))
+  if (kmers > (int64) (MEM_LIMIT/(4*(rshift > 0 ? sizeof(uint64) : sizeof(KmerPos)))))
     { fprintf(stderr,"Warning: Block size too big, index occupies more than 1/4 of");
       if (MEM_LIMIT == MEM_PHYSICAL)
         fprintf(stderr," physical memory (%.1fGb)\n",(1.*MEM_LIMIT)/0x40000000ll);
@@ -875,62 +2179,1271 @@ void *Sort_Kmers(DAZZ_DB *block, int *len)
       fflush(stderr);
     }
 
-  *len = kmers;
-  return (rez);
+  { Kmer_Index *index;
+
+    index = (Kmer_Index *) Malloc(sizeof(Kmer_Index),"Allocating k-mer index");
+    if (index == NULL)
+      Clean_Exit(1);
+    index->list   = rez;
+    index->len    = kmers;
+    index->rshift = rshift;
+    index->rmask  = rmask;
+    index->msize  = 0;
+    index->mbase  = NULL;
+    index->sketch = (MINHASH > 0) ? sketch_block(block) : NULL;
+
+    *len = kmers;
+    return (index);
+  }
 
 no_mers:
   *len = 0;
   return (NULL);
 }
 
+void Free_Kmer_Index(void *vindex)
+{ Kmer_Index *index = (Kmer_Index *) vindex;
+
+  if (index == NULL)
+    return;
+  if (index->msize > 0)
+    munmap(index->mbase,index->msize);
+  else
+    huge_free(index->list);
+  if (index->sketch != NULL)
+    { free(index->sketch->hash);
+      free(index->sketch->post);
+      free(index->sketch->bucket);
+      free(index->sketch);
+    }
+  free(index);
+}
+
 
 /*******************************************************************************************
  *
- *  FILTER MATCH
+ *  PERSISTENT INDEX FILES
+ *
+ *    The sorted k-mer list of a block can be saved to a sidecar file <path>.<part>.kidx (or
+ *    .ckidx for the complemented block) next to the DB and later mmap'd in lieu of rebuilding
+ *    it.  The header records everything the list depends on so that a stale file is ignored.
  *
  ********************************************************************************************/
 
-static int find_tuple(uint64 x, KmerPos *a, int n)
-{ int l, r, m;
-
-  // smallest k s.t. a[k].code >= x (or n if does not exist)
+#define KIDX_MAGIC    "DAZZKIDX"
+#define KIDX_VERSION  6
 
-  l = 0;
-  r = n;
-  while (l < r)
-    { m = ((l+r) >> 1);
-      if (a[m].code < x)
-        l = m+1;
+typedef struct
+  { char   magic[8];
+    int    version;
+    int    kpsize;     //  sizeof(KmerPos), or sizeof(uint64) if packed
+    int    kmer;       //  Kmer
+    int    suppress;   //  Suppress (-t)
+    int    biased;     //  BIASED (-b)
+    int    canon;      //  CANONICAL (-C)
+    int    comp;       //  Index of complemented block?
+    int    nreads;     //  # of reads in block
+    int    window;     //  Minimizer window WINDOW (-W)
+    int64  totlen;     //  # of bases in block
+    int64  masksig;    //  Signature of the soft mask (0 if none)
+    int64  len;        //  # of k-mers in list
+    int    rshift;     //  Packed layout (see Kmer_Index), 0 if not packed
+    int    rmask;
+    int    kfreq;      //  DB-wide suppression frequency KFREQ (-K)
+    int64  kfsig;      //  # of k-mers counted in the .kfreq table if KFREQ (0 otherwise)
+    int64  seedsig;    //  Signature of the spaced seed patterns SEED (0 if none)
+    int64  readsig;    //  Signature of the block's read records (offsets, lengths, wells)
+    int64  bpssize;    //  Size and modification time of the DB's .bps file, so that a
+    int64  bpstime;    //    rebuilt DB is caught even if its reads have the same lengths
+  } Kidx_Header;
+
+static char *kidx_name(DAZZ_DB *block, int comp, char *dir)
+{ char *name, *suffix;
+
+  suffix = comp ? ".ckidx" : ".kidx";
+  if (dir != NULL)
+    { char *root = strrchr(block->path,'/');
+
+      root = (root == NULL ? block->path : root+1);
+      name = (char *) Malloc(strlen(dir)+strlen(root)+30,"Allocating index file name");
+      if (name == NULL)
+        Clean_Exit(1);
+      if (block->part > 0)
+        sprintf(name,"%s/%s.%d%s",dir,root,block->part,suffix);
       else
-        r = m;
+        sprintf(name,"%s/%s%s",dir,root,suffix);
+      return (name);
     }
-  return (l);
+  if (block->part > 0)
+    name = Catenate(block->path,Numbered_Suffix(".",block->part,""),"",suffix);
+  else
+    name = Catenate(block->path,"","",suffix);
+  if (name == NULL)
+    Clean_Exit(1);
+  name = Strdup(name,"Allocating index file name");
+  if (name == NULL)
+    Clean_Exit(1);
+  return (name);
 }
 
-  //  Determine what *will* be the size of the merged list and histogram of sizes for given cutoffs
+static void kidx_header(Kidx_Header *hdr, DAZZ_DB *block, int comp, int64 len)
+{ DAZZ_TRACK *track;
+  DAZZ_READ  *read;
+  struct stat info;
+  char       *bps;
+  uint64      sig, rsig;
+  int         r;
+
+  sig = 0;
+  track = block->tracks;
+  if (track != NULL)
+    { int64 *anno = (int64 *) track->anno;
+      int   *data = (int *) track->data;
+      int64  i;
+
+      sig = anno[block->nreads] + 1;
+      for (i = anno[0]; i < anno[block->nreads]; i++)
+        sig = sig * 0x100000001b3llu + (uint32) data[i];
+    }
 
-static KmerPos  *MG_alist;
-static KmerPos  *MG_blist;
-static SeedPair *MG_hits;
-static int       MG_comp;
-static int       MG_self;
+  rsig = block->nreads + 1;
+  read = block->reads;
+  for (r = 0; r < block->nreads; r++)
+    { rsig = rsig * 0x100000001b3llu + (uint64) read[r].boff;
+      rsig = rsig * 0x100000001b3llu + (uint32) read[r].rlen;
+      rsig = rsig * 0x100000001b3llu + (uint32) read[r].origin;
+      rsig = rsig * 0x100000001b3llu + (uint32) read[r].fpulse;
+      rsig = rsig * 0x100000001b3llu + (uint32) read[r].flags;
+    }
 
-typedef struct
-  { int    abeg, aend;
-    int    bbeg, bend;
-    int64 *kptr;
-    int64  nhits;
-    int    limit;
-    int64  hitgram[MAXGRAM];
-  } Merge_Arg;
+  memset(hdr,0,sizeof(Kidx_Header));
+  memcpy(hdr->magic,KIDX_MAGIC,8);
+  hdr->version  = KIDX_VERSION;
+  hdr->rshift   = kmer_layout(block,&hdr->rmask);
+  hdr->kpsize   = (hdr->rshift > 0) ? sizeof(uint64) : sizeof(KmerPos);
+  hdr->kmer     = Kmer;
+  hdr->suppress = Suppress;
+  hdr->biased   = BIASED;
+  hdr->canon    = CANONICAL;
+  hdr->comp     = comp;
+  hdr->nreads   = block->nreads;
+  hdr->window   = WINDOW;
+  hdr->totlen   = block->totlen;
+  hdr->masksig  = (int64) sig;
+  hdr->len      = len;
+  hdr->kfreq    = KFREQ;
+  hdr->readsig  = (int64) rsig;
+  bps = Catenate(block->path,"","",".bps");
+  if (bps == NULL)
+    Clean_Exit(1);
+  if (stat(bps,&info) == 0)
+    { hdr->bpssize = info.st_size;
+      hdr->bpstime = info.st_mtime;
+    }
+  if (NSEED > 0)
+    { char *c;
+      int   j;
+
+      for (j = 0; j < NSEED; j++)
+        { for (c = SEED[j]; *c != '\0'; c++)
+            hdr->seedsig = hdr->seedsig * 0x100000001b3llu + *c;
+          hdr->seedsig = hdr->seedsig * 0x100000001b3llu + ',';
+        }
+    }
+  if (KFREQ > 0)
+    { load_kfreq(block);
+      hdr->kfsig = KF_sig;
+    }
+}
 
-static void *count_thread(void *arg)
-{ Merge_Arg  *data  = (Merge_Arg *) arg;
-  KmerPos    *asort = MG_alist;
-  KmerPos    *bsort = MG_blist;
-  int64      *gram  = data->hitgram;
-  int64       nhits = 0;
-  int         aend  = data->aend;
+  //  Write the index to a temporary file and rename it so that concurrent jobs never see a
+  //    partially written index.  Failure is not fatal, the index is simply rebuilt next time.
+
+int Save_Kmer_Index(DAZZ_DB *block, int comp, char *dir, void *vindex)
+{ Kmer_Index *index = (Kmer_Index *) vindex;
+  Kidx_Header hdr;
+  char       *name, *temp;
+  FILE       *out;
+  int64       n;
+
+  if (index == NULL)
+    return (1);
+
+  name = kidx_name(block,comp,dir);
+  temp = (char *) Malloc(strlen(name)+30,"Allocating index file name");
+  if (temp == NULL)
+    Clean_Exit(1);
+  sprintf(temp,"%s.%d",name,getpid());
+
+  kidx_header(&hdr,block,comp,index->len);
+
+  n   = index->len+2;
+  out = fopen(temp,"w");
+  if (out == NULL)
+    goto failed;
+  if (fwrite(&hdr,sizeof(Kidx_Header),1,out) != 1)
+    goto failed;
+  if (fwrite(index->list,hdr.kpsize,n,out) != (size_t) n)
+    goto failed;
+  if (fclose(out) != 0)
+    { out = NULL;
+      goto failed;
+    }
+  if (rename(temp,name) != 0)
+    { out = NULL;
+      goto failed;
+    }
+
+  if (VERBOSE)
+    { printf("   Saved index to %s\n",name);
+      fflush(stdout);
+    }
+  free(temp);
+  free(name);
+  return (0);
+
+failed:
+  fprintf(stderr,"%s: Warning: Could not write index file %s\n",Prog_Name,name);
+  if (out != NULL)
+    fclose(out);
+  unlink(temp);
+  free(temp);
+  free(name);
+  return (1);
+}
+
+  //  Return a read-only mapping of the index for block if a valid one exists, NULL otherwise
+
+void *Load_Kmer_Index(DAZZ_DB *block, int comp, char *dir, int *len)
+{ Kidx_Header hdr, *fhdr;
+  Kmer_Index *index;
+  struct stat info;
+  char       *name;
+  void       *base;
+  int         fd;
+
+  *len = 0;
+
+  name = kidx_name(block,comp,dir);
+  fd   = open(name,O_RDONLY);
+  if (fd < 0)
+    { free(name);
+      return (NULL);
+    }
+
+  kidx_header(&hdr,block,comp,0);
+
+  base = MAP_FAILED;
+  if (fstat(fd,&info) == 0 && info.st_size > (off_t) sizeof(Kidx_Header))
+    base = mmap(NULL,info.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if (dir != NULL)
+    unlink(name);     //  A scratch index is used once, the mapping outlives the file
+  if (base == MAP_FAILED)
+    goto stale;
+
+  fhdr    = (Kidx_Header *) base;
+  hdr.len = fhdr->len;
+  if (memcmp(&hdr,fhdr,sizeof(Kidx_Header)) != 0 || hdr.len <= 0 ||
+      (int64) info.st_size != (int64) (sizeof(Kidx_Header) + hdr.kpsize*(hdr.len+2)))
+    { munmap(base,info.st_size);
+      goto stale;
+    }
+
+  index = (Kmer_Index *) Malloc(sizeof(Kmer_Index),"Allocating k-mer index");
+  if (index == NULL)
+    Clean_Exit(1);
+  index->list   = (KmerPos *) (((char *) base) + sizeof(Kidx_Header));
+  index->len    = hdr.len;
+  index->rshift = hdr.rshift;
+  index->rmask  = hdr.rmask;
+  index->msize  = info.st_size;
+  index->mbase  = base;
+  index->sketch = (MINHASH > 0) ? sketch_block(block) : NULL;
+
+  if (VERBOSE)
+    { printf("   Mapped index from %s\n",name);
+      printf("   Index occupies %.2fGb\n",(1. * index->len * hdr.kpsize) / 0x40000000ll);
+      fflush(stdout);
+    }
+
+  free(name);
+  *len = index->len;
+  return (index);
+
+stale:
+  if (VERBOSE)
+    { printf("   Index file %s is stale, rebuilding\n",name);
+      fflush(stdout);
+    }
+  free(name);
+  return (NULL);
+}
+
+
+/*******************************************************************************************
+ *
+ *  MINHASH PRE-FILTER (-j)
+ *
+ *    Each read of a block is sketched by the MH_SIZE least hashes of its canonical k-mers
+ *    when the block is indexed.  A pair of reads whose sketches share fewer than MINHASH
+ *    hashes is deemed unlikely to overlap and its hits are dropped once merged, before they
+ *    are sorted and aligned.  The shared hashes of an A-read and every B-read are counted
+ *    through an index of the B-sketches by hash, so the work is proportional to the number
+ *    of shared hashes rather than the number of read pairs.  If MHAUDIT then no hits are
+ *    dropped, rather the pairs with overlaps that would have been are counted.
+ *
+ ********************************************************************************************/
+
+#define MH_NONE    0xffffffffu    //  Pad of the sketch of a read with fewer than MH_SIZE k-mers
+#define MH_BUFFER  (4*MH_SIZE)    //  Hashes buffered while sketching a read
+#define MH_REPEAT  1000           //  Buckets of the B-index with more entries are ignored
+
+static inline uint32 mh_hash(uint64 c)
+{ c ^= c >> 33;
+  c *= 0xff51afd7ed558ccdllu;
+  c ^= c >> 33;
+  c *= 0xc4ceb9fe1a85ec53llu;
+  c ^= c >> 33;
+  c >>= 32;
+  if (c == MH_NONE)
+    c -= 1;
+  return ((uint32) c);
+}
+
+static int HASH_ORDER(const void *l, const void *r)
+{ uint32 x = *((uint32 *) l);
+  uint32 y = *((uint32 *) r);
+
+  return ((x > y) - (x < y));
+}
+
+static int READ_ORDER(const void *l, const void *r)
+{ return (*((int *) l) - *((int *) r)); }
+
+  //  Sort the n hashes in buf, remove duplicates, and keep at most the MH_SIZE least
+
+static int mh_trim(uint32 *buf, int n)
+{ int i, m;
+
+  if (n == 0)
+    return (0);
+  qsort(buf,n,sizeof(uint32),HASH_ORDER);
+  m = 1;
+  for (i = 1; i < n && m < MH_SIZE; i++)
+    if (buf[i] != buf[m-1])
+      buf[m++] = buf[i];
+  return (m);
+}
+
+typedef struct
+  { DAZZ_DB *block;
+    uint32  *hash;
+    int      beg, end;   //  Sketch reads [beg,end)
+  } Sketch_Arg;
+
+static void *sketch_thread(void *arg)
+{ Sketch_Arg *data  = (Sketch_Arg *) arg;
+  DAZZ_READ  *reads = data->block->reads;
+  char       *bases = (char *) (data->block->bases);
+  int         rsh   = Kshift-2;
+  uint32      buf[MH_BUFFER];
+  uint32     *hash, thr, h;
+  uint64      c, r;
+  char       *s;
+  int         i, n, p, x, len;
+
+  for (i = data->beg; i < data->end; i++)
+    { s    = bases + reads[i].boff;
+      len  = reads[i].rlen;
+      hash = data->hash + ((int64) i)*MH_SIZE;
+      thr  = MH_NONE;
+      n    = 0;
+      c = r = 0;
+      for (p = 0; p < len; p++)
+        { x = s[p];
+          c = ((c << 2) | x) & Kmask;
+          r = (r >> 2) | (((uint64) (3-x)) << rsh);
+          if (p < Kmer-1)
+            continue;
+          h = mh_hash(r < c ? r : c);
+          if (h < thr)
+            { buf[n++] = h;
+              if (n >= MH_BUFFER)
+                { n = mh_trim(buf,n);
+                  if (n >= MH_SIZE)
+                    thr = buf[MH_SIZE-1];
+                }
+            }
+        }
+      n = mh_trim(buf,n);
+      for (p = 0; p < n; p++)
+        hash[p] = buf[p];
+      for ( ; p < MH_SIZE; p++)
+        hash[p] = MH_NONE;
+    }
+
+  return (NULL);
+}
+
+  //  Sketch the reads of block and index the entries of the sketches by the top bits of
+  //    their hashes, with about one entry per bucket
+
+static Sketch *sketch_block(DAZZ_DB *block)
+{ THREAD     threads[NTHREADS];
+  Sketch_Arg parms[NTHREADS];
+  Sketch    *sketch;
+  uint32    *hash;
+  uint64    *post;
+  int64     *bucket;
+  int64      nhash, npost, nbkt, x;
+  int        nreads, bshift;
+  int        i;
+
+  nreads = block->nreads;
+  nhash  = ((int64) nreads) * MH_SIZE;
+
+  sketch = (Sketch *) Malloc(sizeof(Sketch),"Allocating read sketches");
+  hash   = (uint32 *) Malloc(sizeof(uint32)*(nhash+1),"Allocating read sketches");
+  if (sketch == NULL || hash == NULL)
+    Clean_Exit(1);
+
+  for (i = 0; i < NTHREADS; i++)
+    { parms[i].block = block;
+      parms[i].hash  = hash;
+      parms[i].beg   = (((int64) nreads) * i) / NTHREADS;
+      parms[i].end   = (((int64) nreads) * (i+1)) / NTHREADS;
+    }
+
+  for (i = 0; i < NTHREADS; i++)
+    pthread_create(threads+i,thread_attr(i),sketch_thread,parms+i);
+
+  for (i = 0; i < NTHREADS; i++)
+    pthread_join(threads[i],NULL);
+
+  npost = 0;
+  for (x = 0; x < nhash; x++)
+    if (hash[x] != MH_NONE)
+      npost += 1;
+
+  for (i = 1; i < 30 && (1ll << i) < npost; i++)
+    continue;
+  sketch->bbits = i;
+  bshift = 32-i;
+  nbkt   = (1ll << i);
+
+  post   = (uint64 *) Malloc(sizeof(uint64)*(npost+1),"Allocating sketch index");
+  bucket = (int64 *) Malloc(sizeof(int64)*(nbkt+1),"Allocating sketch index");
+  if (post == NULL || bucket == NULL)
+    Clean_Exit(1);
+
+  for (x = 0; x <= nbkt; x++)
+    bucket[x] = 0;
+  for (x = 0; x < nhash; x++)
+    if (hash[x] != MH_NONE)
+      bucket[(hash[x] >> bshift) + 1] += 1;
+  for (x = 1; x <= nbkt; x++)
+    bucket[x] += bucket[x-1];
+  for (x = 0; x < nhash; x++)
+    if (hash[x] != MH_NONE)
+      post[bucket[hash[x] >> bshift]++] = (((uint64) hash[x]) << 32) | (x / MH_SIZE);
+  for (x = nbkt; x > 0; x--)
+    bucket[x] = bucket[x-1];
+  bucket[0] = 0;
+
+  sketch->nreads = nreads;
+  sketch->hash   = hash;
+  sketch->post   = post;
+  sketch->bucket = bucket;
+  return (sketch);
+}
+
+static int   *MH_cand = NULL;   //  The candidate B-reads of A-read a, in increasing order, are
+static int64 *MH_cbeg = NULL;   //    MH_cand[MH_cbeg[a],MH_cbeg[a+1]), MH_cbeg is NULL if none
+
+typedef struct
+  { Sketch *asketch;
+    Sketch *bsketch;
+    int     beg, end;   //  Find the candidates of A-reads [beg,end)
+    int    *list;       //  in list[0,ncand) where list has room for nmax
+    int64   ncand;
+    int64   nmax;
+  } Cand_Arg;
+
+static void *cand_thread(void *arg)
+{ Cand_Arg *data   = (Cand_Arg *) arg;
+  Sketch   *bsk    = data->bsketch;
+  uint64   *post   = bsk->post;
+  int64    *bucket = bsk->bucket;
+  int       bshift = 32-bsk->bbits;
+  int      *list   = data->list;
+  int64     nmax   = data->nmax;
+  int64     n      = 0;
+  uint8    *count;
+  int      *touch;
+  uint32   *hash, h;
+  int64     p, e, m;
+  int       a, b, i, t, ntouch;
+
+  count = (uint8 *) Malloc(bsk->nreads+1,"Allocating sketch counters");
+  touch = (int *) Malloc(sizeof(int)*(bsk->nreads+1),"Allocating sketch counters");
+  if (count == NULL || touch == NULL)
+    Clean_Exit(1);
+  memset(count,0,bsk->nreads+1);
+
+  for (a = data->beg; a < data->end; a++)
+    { hash   = data->asketch->hash + ((int64) a)*MH_SIZE;
+      m      = n;
+      ntouch = 0;
+      for (i = 0; i < MH_SIZE && (h = hash[i]) != MH_NONE; i++)
+        { p = bucket[h >> bshift];
+          e = bucket[(h >> bshift) + 1];
+          if (e-p > MH_REPEAT)
+            continue;
+          for ( ; p < e; p++)
+            if ((post[p] >> 32) == h)
+              { b = (int) (post[p] & 0xffffffffllu);
+                if ((t = count[b]++) == 0)
+                  touch[ntouch++] = b;
+                if (t+1 == MINHASH)
+                  { if (n >= nmax)
+                      { nmax = 1.2*n + 10000;
+                        list = (int *) Realloc(list,sizeof(int)*nmax,"Allocating candidate pairs");
+                        if (list == NULL)
+                          Clean_Exit(1);
+                      }
+                    list[n++] = b;
+                  }
+              }
+        }
+      for (i = 0; i < ntouch; i++)
+        count[touch[i]] = 0;
+      qsort(list+m,n-m,sizeof(int),READ_ORDER);
+      MH_cbeg[a+1] = n-m;
+    }
+
+  free(touch);
+  free(count);
+
+  data->list  = list;
+  data->ncand = n;
+  data->nmax  = nmax;
+  return (NULL);
+}
+
+  //  Set MH_cand and MH_cbeg to the pairs of A- and B-reads whose sketches share MINHASH or
+  //    more hashes, and return their number
+
+static int64 mh_candidates(Sketch *asketch, Sketch *bsketch)
+{ THREAD   threads[NTHREADS];
+  Cand_Arg parmc[NTHREADS];
+  int64    ncand;
+  int      nreads;
+  int      i, a;
+
+  nreads  = asketch->nreads;
+  MH_cbeg = (int64 *) Malloc(sizeof(int64)*(nreads+1),"Allocating candidate pairs");
+  if (MH_cbeg == NULL)
+    Clean_Exit(1);
+
+  for (i = 0; i < NTHREADS; i++)
+    { parmc[i].asketch = asketch;
+      parmc[i].bsketch = bsketch;
+      parmc[i].beg     = (((int64) nreads) * i) / NTHREADS;
+      parmc[i].end     = (((int64) nreads) * (i+1)) / NTHREADS;
+      parmc[i].list    = NULL;
+      parmc[i].nmax    = 0;
+    }
+
+  for (i = 0; i < NTHREADS; i++)
+    pthread_create(threads+i,thread_attr(i),cand_thread,parmc+i);
+
+  for (i = 0; i < NTHREADS; i++)
+    pthread_join(threads[i],NULL);
+
+  ncand = 0;
+  for (i = 0; i < NTHREADS; i++)
+    ncand += parmc[i].ncand;
+
+  MH_cand = (int *) Malloc(sizeof(int)*(ncand+1),"Allocating candidate pairs");
+  if (MH_cand == NULL)
+    Clean_Exit(1);
+
+  ncand = 0;
+  for (i = 0; i < NTHREADS; i++)
+    { memcpy(MH_cand+ncand,parmc[i].list,sizeof(int)*parmc[i].ncand);
+      ncand += parmc[i].ncand;
+      free(parmc[i].list);
+    }
+
+  MH_cbeg[0] = 0;
+  for (a = 1; a <= nreads; a++)
+    MH_cbeg[a] += MH_cbeg[a-1];
+
+  return (ncand);
+}
+
+static inline int mh_candidate(int a, int b)
+{ int64 l, r, m;
+
+  l = MH_cbeg[a];
+  r = MH_cbeg[a+1];
+  while (l < r)
+    { m = ((l+r) >> 1);
+      if (MH_cand[m] < b)
+        l = m+1;
+      else
+        r = m;
+    }
+  return (l < MH_cbeg[a+1] && MH_cand[l] == b);
+}
+
+static void mh_free()
+{ free(MH_cand);
+  free(MH_cbeg);
+  MH_cand = NULL;
+  MH_cbeg = NULL;
+}
+
+typedef struct
+  { SeedPair *hits;
+    int64     beg, end;   //  Segment of hits, on return [beg,end) are those kept
+    int64    *kptr;       //  Histogram of the low apos bytes of the hits kept (for lex_sort)
+  } Prune_Arg;
+
+static void *prune_thread(void *arg)
+{ Prune_Arg *data = (Prune_Arg *) arg;
+  SeedPair  *hits = data->hits;
+  int64     *kptr = data->kptr;
+  int64      i, n;
+
+  for (i = 0; i < BPOWR; i++)
+    kptr[i] = 0;
+
+  n = data->beg;
+  for (i = data->beg; i < data->end; i++)
+    if (mh_candidate(hits[i].aread,hits[i].bread))
+      { hits[n] = hits[i];
+        kptr[hits[n].apos & BMASK] += 1;
+        n += 1;
+      }
+  data->end = n;
+
+  return (NULL);
+}
+
+  //  Drop the hits between pairs that are not candidates from each thread segment
+  //    [off[t],off[t+1]) of hits, close up the segments, reset off to their new starts, and
+  //    return the number of hits left.  kptr[t] is reset to the histogram of segment t.
+
+static int64 prune_hits(SeedPair *hits, int64 *off, int64 **kptr)
+{ THREAD    threads[NTHREADS];
+  Prune_Arg parmp[NTHREADS];
+  int64     n;
+  int       i;
+
+  for (i = 0; i < NTHREADS; i++)
+    { parmp[i].hits = hits;
+      parmp[i].beg  = off[i];
+      parmp[i].end  = off[i+1];
+      parmp[i].kptr = kptr[i];
+    }
+
+  for (i = 0; i < NTHREADS; i++)
+    pthread_create(threads+i,thread_attr(i),prune_thread,parmp+i);
+
+  for (i = 0; i < NTHREADS; i++)
+    pthread_join(threads[i],NULL);
+
+  n = 0;
+  for (i = 0; i < NTHREADS; i++)
+    { if (n < parmp[i].beg)
+        memmove(hits+n,hits+parmp[i].beg,sizeof(SeedPair)*(parmp[i].end-parmp[i].beg));
+      off[i] = n;
+      n += parmp[i].end - parmp[i].beg;
+    }
+  off[NTHREADS] = n;
+
+  return (n);
+}
+
+
+/*******************************************************************************************
+ *
+ *  ASYNCHRONOUS OVERLAP WRITER
+ *
+ ********************************************************************************************/
+
+  //  The overlaps of a report chunk are committed to their .las file by handing the chunk's
+  //    memory buffer, along with the file offset it is to occupy, to a background thread that
+  //    pwrite's it, so that the report threads never wait on the disk.  The offsets are
+  //    assigned in chunk order at commit time, so the order in which buffers reach the disk
+  //    does not matter.  Only if WRITE_QUEUE bytes are waiting to be written does a committing
+  //    thread wait for the writer, and the time it does so is recorded as a stall.
+  //
+  //  O_DIRECT is not used: the records are not block aligned and the files are read back by
+  //    LAsort straight after, so going through the page cache is the better bargain.
+
+#define WRITE_QUEUE  0x10000000ll   //  Bytes that may await writing before a commit waits
+
+typedef struct Write_Job
+  { struct Write_Job *next;
+    int               fd;       //  Write len bytes of buf at offset off of fd, then free buf
+    int64             off;
+    char             *buf;
+    size_t            len;
+  } Write_Job;
+
+static Write_Job      *WR_head;     //  Queue of jobs
+static Write_Job      *WR_tail;
+static int64           WR_queued;   //  Bytes in the queue
+static int             WR_done;     //  No more jobs will be queued
+static pthread_mutex_t WR_lock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  WR_work  = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  WR_space = PTHREAD_COND_INITIALIZER;
+static pthread_t       WR_thread;
+
+static int64  WR_bytes;   //  Bytes written, seconds spent writing them, and seconds report
+static double WR_busy;    //    threads stalled on a full queue, over the current Match_Filter
+static double WR_stall;
+
+static void *writer_thread(void *arg)
+{ Write_Job *job;
+  ssize_t    n;
+  size_t     x;
+  double     start;
+
+  (void) arg;
+
+  while (1)
+    { pthread_mutex_lock(&WR_lock);
+      while (WR_head == NULL && ! WR_done)
+        pthread_cond_wait(&WR_work,&WR_lock);
+      job = WR_head;
+      if (job != NULL)
+        { WR_head = job->next;
+          if (WR_head == NULL)
+            WR_tail = NULL;
+        }
+      pthread_mutex_unlock(&WR_lock);
+      if (job == NULL)
+        break;
+
+      start = wall_clock();
+      for (x = 0; x < job->len; x += n)
+        { n = pwrite(job->fd,job->buf+x,job->len-x,job->off+x);
+          if (n < 0 && errno == EINTR)
+            n = 0;
+          else if (n <= 0)
+            { fprintf(stderr,"%s: Cannot write to %s, too small?\n",Prog_Name,SORT_PATH);
+              Clean_Exit(1);
+            }
+        }
+      WR_busy += wall_clock() - start;
+
+      pthread_mutex_lock(&WR_lock);
+      WR_bytes  += job->len;
+      WR_queued -= job->len;
+      pthread_cond_broadcast(&WR_space);
+      pthread_mutex_unlock(&WR_lock);
+
+      free(job->buf);
+      free(job);
+    }
+
+  return (NULL);
+}
+
+static void write_start()
+{ WR_head   = WR_tail = NULL;
+  WR_queued = 0;
+  WR_done   = 0;
+  WR_bytes  = 0;
+  WR_busy   = WR_stall = 0.;
+  if (pthread_create(&WR_thread,NULL,writer_thread,NULL) != 0)
+    { fprintf(stderr,"%s: Cannot start overlap writer thread\n",Prog_Name);
+      Clean_Exit(1);
+    }
+}
+
+  //  Queue buf (which becomes the writer's to free) to be written at offset off of fd
+
+static void write_queue(int fd, int64 off, char *buf, size_t len)
+{ Write_Job *job;
+  double     start;
+
+  if (len == 0)
+    { free(buf);
+      return;
+    }
+  job = (Write_Job *) Malloc(sizeof(Write_Job),"Allocating write job");
+  if (job == NULL)
+    Clean_Exit(1);
+  job->next = NULL;
+  job->fd   = fd;
+  job->off  = off;
+  job->buf  = buf;
+  job->len  = len;
+
+  pthread_mutex_lock(&WR_lock);
+  if (WR_queued >= WRITE_QUEUE)
+    { start = wall_clock();
+      while (WR_queued >= WRITE_QUEUE)
+        pthread_cond_wait(&WR_space,&WR_lock);
+      WR_stall += wall_clock() - start;
+    }
+  if (WR_tail == NULL)
+    WR_head = job;
+  else
+    WR_tail->next = job;
+  WR_tail    = job;
+  WR_queued += len;
+  pthread_cond_signal(&WR_work);
+  pthread_mutex_unlock(&WR_lock);
+}
+
+  //  Wait for every queued buffer to be written and stop the writer
+
+static void write_finish()
+{ pthread_mutex_lock(&WR_lock);
+  WR_done = 1;
+  pthread_cond_signal(&WR_work);
+  pthread_mutex_unlock(&WR_lock);
+  pthread_join(WR_thread,NULL);
+}
+
+
+/*******************************************************************************************
+ *
+ *  FILTER MATCH
+ *
+ ********************************************************************************************/
+
+static int find_tuple(uint64 x, KmerPos *a, int n)
+{ int l, r, m;
+
+  // smallest k s.t. a[k].code >= x (or n if does not exist)
+
+  l = 0;
+  r = n;
+  while (l < r)
+    { m = ((l+r) >> 1);
+      if (a[m].code < x)
+        l = m+1;
+      else
+        r = m;
+    }
+  return (l);
+}
+
+static int find_packed_tuple(uint64 x, uint64 *a, int n)
+{ int l, r, m;
+
+  l = 0;
+  r = n;
+  while (l < r)
+    { m = ((l+r) >> 1);
+      if (PK_CODE(a[m]) < x)
+        l = m+1;
+      else
+        r = m;
+    }
+  return (l);
+}
+
+  //  Expand a packed list into a (huge_alloc'd) KmerPos list with the usual sentinels
+
+static KmerPos *unpack_kmers(Kmer_Index *index)
+{ uint64  *pk   = (uint64 *) index->list;
+  int      rsh  = index->rshift;
+  int      rmk  = index->rmask;
+  uint64   pmk  = (1llu << rsh) - 1;
+  KmerPos *list;
+  int      i;
+
+  list = (KmerPos *) huge_alloc(sizeof(KmerPos)*(index->len+2),"Unpacking k-mer index");
+  if (list == NULL)
+    Clean_Exit(1);
+  for (i = 0; i < index->len; i++)
+    { list[i].code = PK_CODE(pk[i]);
+      list[i].read = PK_READ(pk[i],rsh,rmk);
+      list[i].rpos = PK_RPOS(pk[i],pmk);
+    }
+  list[i].code   = 0xffffffffffffffffllu;
+  list[i+1].code = 0;
+  return (list);
+}
+
+  //  Determine what *will* be the size of the merged list and histogram of sizes for given cutoffs
+
+static KmerPos  *MG_alist;
+static KmerPos  *MG_blist;
+static SeedPair *MG_hits;
+static int       MG_comp;
+static int       MG_self;
+static int       MG_rlo;      //  Only A-reads in [MG_rlo,MG_rhi) are merged (see SLABS)
+static int       MG_rhi;
+
+static uint64   *MG_apk;      //  The A- and B-lists and their layouts when both are packed
+static uint64   *MG_bpk;
+static int       MG_arshift, MG_armask;
+static int       MG_brshift, MG_brmask;
+
+  //  In FUSED mode the merge threads make the one and only pass over the lists, histogramming
+  //    the groups as count_thread would while appending hits to chunks of FUSE_CHUNK or more
+  //    seed pairs.  Chunks are charged to a common budget of FU_budget pairs, and once it
+  //    is exhausted every thread just counts the rest of its range and the classic merge
+  //    follows (see Match_Filter).
+
+#define FUSE_CHUNK 0x200000
+
+typedef struct
+  { SeedPair *base;           //  Hits [beg,beg of next chunk) of the thread are in base[0..]
+    int64     beg;
+  } Fuse_Chunk;
+
+static int64 FU_budget;
+static int64 FU_used;
+static int   FU_over;
+
+typedef struct
+  { int    abeg, aend;
+    int    bbeg, bend;
+    int64 *kptr;
+    int64  nhits;
+    int    limit;
+    int64  hitgram[MAXGRAM];
+    int64 *ckptr;             //  Histogram, offset, cutoff, and counts of the reverse hits
+    int64  chits;             //    found along with the forward ones in CANONICAL mode
+    int    climit;
+    int64 *cgram;
+    int64 *rcnt;              //  Hits of each A-read (SLABS mode)
+    int         fused;        //  FUSED mode: hits[nhits] may be written for nhits < hend (the
+    int64       hend;         //    hit count once done) and the hits are in chunk[0..nchunk-1]
+    Fuse_Chunk *chunk;
+    int         nchunk, mchunk;
+  } Merge_Arg;
+
+  //  Start a new chunk for hits nhits on of which at least need are wanted, returning the
+  //    base that hits are indexed from, or NULL if the budget is exhausted
+
+static SeedPair *fuse_chunk(Merge_Arg *data, int64 nhits, int64 need, int64 *hend)
+{ Fuse_Chunk *f;
+  int64       size;
+
+  size = FUSE_CHUNK;
+  if (need > size)
+    size = need;
+  if (FU_over || __sync_add_and_fetch(&FU_used,size) > FU_budget)
+    { FU_over = 1;
+      return (NULL);
+    }
+
+  if (data->nchunk >= data->mchunk)
+    { data->mchunk = 1.2*data->nchunk + 10;
+      data->chunk  = (Fuse_Chunk *) Realloc(data->chunk,sizeof(Fuse_Chunk)*data->mchunk,
+                                            "Allocating hit chunks");
+      if (data->chunk == NULL)
+        Clean_Exit(1);
+    }
+  f = data->chunk + data->nchunk++;
+  f->base = (SeedPair *) huge_alloc(sizeof(SeedPair)*size,"Allocating hit chunks");
+  if (f->base == NULL)
+    Clean_Exit(1);
+  f->beg = nhits;
+
+  *hend = nhits + size;
+  return (f->base - nhits);
+}
+
+  //  Move the chunked hits of a thread to MG_hits + data->nhits and free the chunks
+
+static void *fuse_copy_thread(void *arg)
+{ Merge_Arg  *data  = (Merge_Arg *) arg;
+  SeedPair   *hits  = MG_hits + data->nhits;
+  Fuse_Chunk *f;
+  int64       end;
+  int         c;
+
+  for (c = 0; c < data->nchunk; c++)
+    { f = data->chunk + c;
+      if (c+1 < data->nchunk)
+        end = f[1].beg;
+      else
+        end = data->hend;
+      memcpy(hits + f->beg,f->base,sizeof(SeedPair)*(end - f->beg));
+      huge_free(f->base);
+    }
+  free(data->chunk);
+  data->chunk  = NULL;
+  data->nchunk = data->mchunk = 0;
+  return (NULL);
+}
+
+static void fuse_free(Merge_Arg *data)
+{ int c;
+
+  for (c = 0; c < data->nchunk; c++)
+    huge_free(data->chunk[c].base);
+  free(data->chunk);
+  data->chunk  = NULL;
+  data->nchunk = data->mchunk = 0;
+}
+
+static void *count_thread(void *arg)
+{ Merge_Arg  *data  = (Merge_Arg *) arg;
+  KmerPos    *asort = MG_alist;
+  KmerPos    *bsort = MG_blist;
+  int64      *gram  = data->hitgram;
+  int64       nhits = 0;
+  int         aend  = data->aend;
+
+  int64  ct;
+  int    ia, ib;
+  int    jb, ja;
+  uint64 ca, cb;
+  uint64 da, db;
+  int    ar, ap;
+  int    a, b;
+
+  ia = data->abeg;
+  ca = asort[ia].code;
+  ib = data->bbeg;
+  cb = bsort[ib].code;
+  if (MG_self)
+    { while (1)
+        { while (cb < ca)
+            cb = bsort[++ib].code;
+          while (cb > ca)
+            ca = asort[++ia].code;
+          if (cb == ca)
+            { ja = ia++;
+              while ((da = asort[ia].code) == ca)
+                ia += 1;
+              jb = ib++;
+              while ((db = bsort[ib].code) == cb)
+                ib += 1;
+
+              if (ia > aend)
+                { if (ja >= aend)
+                    break;
+                  da = asort[ia = aend].code;
+                  db = bsort[ib = data->bend].code;
+                }
+
+              ct = 0;
+              b  = jb;
+              if (IDENTITY)
+                for (a = ja; a < ia; a++)
+                  { ar = asort[a].read;
+                    if (MG_comp)
+                      { while (b < ib && bsort[b].read <= ar)
+                          b += 1;
+                      }
+                    else
+                      { ap = asort[a].rpos;
+                        while (b < ib && bsort[b].read < ar)
+                          b += 1;
+                        while (b < ib && bsort[b].read == ar && bsort[b].rpos < ap)
+                          b += 1;
+                      }
+                    ct += (b-jb);
+                  }
+              else
+                for (a = ja; a < ia; a++)
+                  { ar = asort[a].read;
+                    while (b < ib && bsort[b].read < ar)
+                      b += 1;
+                    ct += (b-jb);
+                  }
+
+              nhits += ct;
+              ca = da;
+              cb = db;
+
+              if (ct < MAXGRAM)
+                gram[ct] += 1;
+            }
+        }
+    }
+  else
+    { while (1)
+        { while (cb < ca)
+            cb = bsort[++ib].code;
+          while (cb > ca)
+            ca = asort[++ia].code;
+          if (cb == ca)
+            { ja = ia++;
+              while ((da = asort[ia].code) == ca)
+                ia += 1;
+              jb = ib++;
+              while ((db = bsort[ib].code) == cb)
+                ib += 1;
+
+              if (ia > aend)
+                { if (ja >= aend)
+                    break;
+                  da = asort[ia = aend].code;
+                  db = bsort[ib = data->bend].code;
+                }
+
+              ct  = (ia-ja);
+              ct *= (ib-jb);
+
+              nhits += ct;
+              ca = da;
+              cb = db;
+
+              if (ct < MAXGRAM)
+                gram[ct] += 1;
+            }
+        }
+    }
+
+  data->nhits = nhits;
+
+  return (NULL);
+}
+
+static void *count_packed_thread(void *arg)
+{ Merge_Arg  *data  = (Merge_Arg *) arg;
+  uint64     *asort = MG_apk;
+  uint64     *bsort = MG_bpk;
+  int         arsh  = MG_arshift;
+  int         armk  = MG_armask;
+  uint64      apmk  = (1llu << arsh) - 1;
+  int         brsh  = MG_brshift;
+  int         brmk  = MG_brmask;
+  uint64      bpmk  = (1llu << brsh) - 1;
+  int64      *gram  = data->hitgram;
+  int64       nhits = 0;
+  int         aend  = data->aend;
+
+  int64  ct;
+  int    ia, ib;
+  int    jb, ja;
+  uint64 ca, cb;
+  uint64 da, db;
+  int    ar, ap;
+  int    a, b;
+
+  ia = data->abeg;
+  ca = PK_CODE(asort[ia]);
+  ib = data->bbeg;
+  cb = PK_CODE(bsort[ib]);
+  if (MG_self)
+    { while (1)
+        { while (cb < ca)
+            cb = PK_CODE(bsort[++ib]);
+          while (cb > ca)
+            ca = PK_CODE(asort[++ia]);
+          if (cb == ca)
+            { ja = ia++;
+              while ((da = PK_CODE(asort[ia])) == ca)
+                ia += 1;
+              jb = ib++;
+              while ((db = PK_CODE(bsort[ib])) == cb)
+                ib += 1;
+
+              if (ia > aend)
+                { if (ja >= aend)
+                    break;
+                  da = PK_CODE(asort[ia = aend]);
+                  db = PK_CODE(bsort[ib = data->bend]);
+                }
+
+              ct = 0;
+              b  = jb;
+              if (IDENTITY)
+                for (a = ja; a < ia; a++)
+                  { ar = PK_READ(asort[a],arsh,armk);
+                    if (MG_comp)
+                      { while (b < ib && PK_READ(bsort[b],brsh,brmk) <= ar)
+                          b += 1;
+                      }
+                    else
+                      { ap = PK_RPOS(asort[a],apmk);
+                        while (b < ib && PK_READ(bsort[b],brsh,brmk) < ar)
+                          b += 1;
+                        while (b < ib && PK_READ(bsort[b],brsh,brmk) == ar
+                                      && PK_RPOS(bsort[b],bpmk) < ap)
+                          b += 1;
+                      }
+                    ct += (b-jb);
+                  }
+              else
+                for (a = ja; a < ia; a++)
+                  { ar = PK_READ(asort[a],arsh,armk);
+                    while (b < ib && PK_READ(bsort[b],brsh,brmk) < ar)
+                      b += 1;
+                    ct += (b-jb);
+                  }
+
+              nhits += ct;
+              ca = da;
+              cb = db;
+
+              if (ct < MAXGRAM)
+                gram[ct] += 1;
+            }
+        }
+    }
+  else
+    { while (1)
+        { while (cb < ca)
+            cb = PK_CODE(bsort[++ib]);
+          while (cb > ca)
+            ca = PK_CODE(asort[++ia]);
+          if (cb == ca)
+            { ja = ia++;
+              while ((da = PK_CODE(asort[ia])) == ca)
+                ia += 1;
+              jb = ib++;
+              while ((db = PK_CODE(bsort[ib])) == cb)
+                ib += 1;
+
+              if (ia > aend)
+                { if (ja >= aend)
+                    break;
+                  da = PK_CODE(asort[ia = aend]);
+                  db = PK_CODE(bsort[ib = data->bend]);
+                }
+
+              ct  = (ia-ja);
+              ct *= (ib-jb);
+
+              nhits += ct;
+              ca = da;
+              cb = db;
+
+              if (ct < MAXGRAM)
+                gram[ct] += 1;
+            }
+        }
+    }
+
+  data->nhits = nhits;
+
+  return (NULL);
+}
+
+  //  Produce the merged list now that the list has been allocated and
+  //    the appropriate cutoff determined.
+
+static void *merge_thread(void *arg)
+{ Merge_Arg  *data  = (Merge_Arg *) arg;
+  int64      *kptr  = data->kptr;
+  KmerPos    *asort = MG_alist;
+  KmerPos    *bsort = MG_blist;
+  SeedPair   *hits  = MG_hits;
+  int64       nhits = data->nhits;
+  int         aend  = data->aend;
+  int         limit = data->limit;
+  int64      *gram  = data->hitgram;
+  int         fused = data->fused;
+  int64       hend  = data->hend;
+  int64       total = 0;
+  int         over  = 0;
 
   int64  ct;
   int    ia, ib;
@@ -938,7 +3451,7 @@ static void *count_thread(void *arg)
   uint64 ca, cb;
   uint64 da, db;
   int    ar, ap;
-  int    a, b;
+  int    a, b, c;
 
   ia = data->abeg;
   ca = asort[ia].code;
@@ -991,12 +3504,64 @@ static void *count_thread(void *arg)
                     ct += (b-jb);
                   }
 
-              nhits += ct;
+              if (fused)
+                { if (ct < limit && nhits + ct > hend
+                                 && (hits = fuse_chunk(data,nhits,ct,&hend)) == NULL)
+                    { over = 1;
+                      break;
+                    }
+                  total += ct;
+                  if (ct < MAXGRAM)
+                    gram[ct] += 1;
+                }
+
+              if (ct < limit)
+                { b = jb;
+                  if (IDENTITY)
+                    for (a = ja; a < ia; a++)
+                      { ap = asort[a].rpos;
+                        ar = asort[a].read;
+                        if (MG_comp)
+                          { while (b < ib && bsort[b].read <= ar)
+                              b += 1;
+                          }
+                        else
+                          { while (b < ib && bsort[b].read < ar)
+                              b += 1;
+                            while (b < ib && bsort[b].read == ar && bsort[b].rpos < ap)
+                              b += 1;
+                          }
+                        if ((ct = b-jb) > 0 && ar >= MG_rlo && ar < MG_rhi)
+                          { kptr[ap & BMASK] += ct;
+                            for (c = jb; c < b; c++)
+                              { hits[nhits].bread = bsort[c].read;
+                                hits[nhits].aread = ar;
+                                hits[nhits].apos  = ap; 
+                                hits[nhits].diag  = ap - bsort[c].rpos;
+                                nhits += 1;
+                              }
+                          }
+                      }
+                  else
+                    for (a = ja; a < ia; a++)
+                      { ap = asort[a].rpos;
+                        ar = asort[a].read;
+                        while (b < ib && bsort[b].read < ar)
+                          b += 1;
+                        if ((ct = b-jb) > 0 && ar >= MG_rlo && ar < MG_rhi)
+                          { kptr[ap & BMASK] += ct;
+                            for (c = jb; c < b; c++)
+                              { hits[nhits].bread = bsort[c].read;
+                                hits[nhits].aread = ar;
+                                hits[nhits].apos  = ap; 
+                                hits[nhits].diag  = ap - bsort[c].rpos;
+                                nhits += 1;
+                              }
+                          }
+                      }
+                }
               ca = da;
               cb = db;
-
-              if (ct < MAXGRAM)
-                gram[ct] += 1;
             }
         }
     }
@@ -1007,7 +3572,8 @@ static void *count_thread(void *arg)
           while (cb > ca)
             ca = asort[++ia].code;
           if (cb == ca)
-            { ja = ia++;
+            { if (ia >= aend) break;
+              ja = ia++;
               while ((da = asort[ia].code) == ca)
                 ia += 1;
               jb = ib++;
@@ -1021,36 +3587,87 @@ static void *count_thread(void *arg)
                   db = bsort[ib = data->bend].code;
                 }
 
-              ct  = (ia-ja);
-              ct *= (ib-jb);
+              ct = ib-jb;
+              if (fused)
+                { int64 pt = (ia-ja)*ct;
 
-              nhits += ct;
+                  if (pt < limit && nhits + pt > hend
+                                 && (hits = fuse_chunk(data,nhits,pt,&hend)) == NULL)
+                    { over = 1;
+                      break;
+                    }
+                  total += pt;
+                  if (pt < MAXGRAM)
+                    gram[pt] += 1;
+                }
+
+              if ((ia-ja)*ct < limit)
+                { for (a = ja; a < ia; a++)
+                    { ap = asort[a].rpos;
+                      ar = asort[a].read;
+                      if (ar < MG_rlo || ar >= MG_rhi)
+                        continue;
+                      kptr[ap & BMASK] += ct;
+                      for (b = jb; b < ib; b++)
+                        { hits[nhits].bread = bsort[b].read;
+                          hits[nhits].aread = ar;
+                          hits[nhits].apos  = ap;
+                          hits[nhits].diag  = ap - bsort[b].rpos;
+                          nhits += 1;
+                        }
+                    }
+                }
               ca = da;
               cb = db;
-
-              if (ct < MAXGRAM)
-                gram[ct] += 1;
             }
         }
     }
 
-  data->nhits = nhits;
+  //  In FUSED mode if the budget ran out then the rest of the range is counted from the group
+  //    that did not fit.  Either way nhits is the count count_thread gives, and hend is set to
+  //    the number of hits produced in case no thread ran out.
+
+  if (fused)
+    { if (over)
+        { int sa = data->abeg;
+          int sb = data->bbeg;
+
+          data->abeg = ja;
+          data->bbeg = jb;
+          count_thread(data);
+          data->nhits += total;
+          data->abeg = sa;
+          data->bbeg = sb;
+        }
+      else
+        { data->nhits = total;
+          data->hend  = nhits;
+        }
+    }
 
   return (NULL);
 }
 
-  //  Produce the merged list now that the list has been allocated and
-  //    the appropriate cutoff determined.
-
-static void *merge_thread(void *arg)
+static void *merge_packed_thread(void *arg)
 { Merge_Arg  *data  = (Merge_Arg *) arg;
   int64      *kptr  = data->kptr;
-  KmerPos    *asort = MG_alist;
-  KmerPos    *bsort = MG_blist;
+  uint64     *asort = MG_apk;
+  uint64     *bsort = MG_bpk;
+  int         arsh  = MG_arshift;
+  int         armk  = MG_armask;
+  uint64      apmk  = (1llu << arsh) - 1;
+  int         brsh  = MG_brshift;
+  int         brmk  = MG_brmask;
+  uint64      bpmk  = (1llu << brsh) - 1;
   SeedPair   *hits  = MG_hits;
   int64       nhits = data->nhits;
   int         aend  = data->aend;
   int         limit = data->limit;
+  int64      *gram  = data->hitgram;
+  int         fused = data->fused;
+  int64       hend  = data->hend;
+  int64       total = 0;
+  int         over  = 0;
 
   int64  ct;
   int    ia, ib;
@@ -1061,144 +3678,519 @@ static void *merge_thread(void *arg)
   int    a, b, c;
 
   ia = data->abeg;
-  ca = asort[ia].code;
+  ca = PK_CODE(asort[ia]);
   ib = data->bbeg;
-  cb = bsort[ib].code;
+  cb = PK_CODE(bsort[ib]);
   if (MG_self)
     { while (1)
         { while (cb < ca)
-            cb = bsort[++ib].code;
+            cb = PK_CODE(bsort[++ib]);
           while (cb > ca)
-            ca = asort[++ia].code;
+            ca = PK_CODE(asort[++ia]);
           if (cb == ca)
             { ja = ia++;
-              while ((da = asort[ia].code) == ca)
+              while ((da = PK_CODE(asort[ia])) == ca)
                 ia += 1;
               jb = ib++;
-              while ((db = bsort[ib].code) == cb)
+              while ((db = PK_CODE(bsort[ib])) == cb)
                 ib += 1;
 
               if (ia > aend)
                 { if (ja >= aend)
                     break;
-                  da = asort[ia = aend].code;
-                  db = bsort[ib = data->bend].code;
+                  da = PK_CODE(asort[ia = aend]);
+                  db = PK_CODE(bsort[ib = data->bend]);
                 }
 
               ct = 0;
               b  = jb;
               if (IDENTITY)
                 for (a = ja; a < ia; a++)
-                  { ar = asort[a].read;
+                  { ar = PK_READ(asort[a],arsh,armk);
                     if (MG_comp)
-                      { while (b < ib && bsort[b].read <= ar)
+                      { while (b < ib && PK_READ(bsort[b],brsh,brmk) <= ar)
                           b += 1;
                       }
                     else
-                      { ap = asort[a].rpos;
-                        while (b < ib && bsort[b].read < ar)
+                      { ap = PK_RPOS(asort[a],apmk);
+                        while (b < ib && PK_READ(bsort[b],brsh,brmk) < ar)
                           b += 1;
-                        while (b < ib && bsort[b].read == ar && bsort[b].rpos < ap)
+                        while (b < ib && PK_READ(bsort[b],brsh,brmk) == ar
+                                      && PK_RPOS(bsort[b],bpmk) < ap)
                           b += 1;
                       }
                     ct += (b-jb);
                   }
               else
                 for (a = ja; a < ia; a++)
-                  { ar = asort[a].read;
-                    while (b < ib && bsort[b].read < ar)
+                  { ar = PK_READ(asort[a],arsh,armk);
+                    while (b < ib && PK_READ(bsort[b],brsh,brmk) < ar)
                       b += 1;
                     ct += (b-jb);
                   }
 
-              if (ct < limit)
-                { b = jb;
-                  if (IDENTITY)
-                    for (a = ja; a < ia; a++)
-                      { ap = asort[a].rpos;
-                        ar = asort[a].read;
-                        if (MG_comp)
-                          { while (b < ib && bsort[b].read <= ar)
-                              b += 1;
-                          }
-                        else
-                          { while (b < ib && bsort[b].read < ar)
-                              b += 1;
-                            while (b < ib && bsort[b].read == ar && bsort[b].rpos < ap)
-                              b += 1;
-                          }
-                        if ((ct = b-jb) > 0)
-                          { kptr[ap & BMASK] += ct;
-                            for (c = jb; c < b; c++)
-                              { hits[nhits].bread = bsort[c].read;
-                                hits[nhits].aread = ar;
-                                hits[nhits].apos  = ap; 
-                                hits[nhits].diag  = ap - bsort[c].rpos;
-                                nhits += 1;
-                              }
-                          }
-                      }
-                  else
-                    for (a = ja; a < ia; a++)
-                      { ap = asort[a].rpos;
-                        ar = asort[a].read;
-                        while (b < ib && bsort[b].read < ar)
-                          b += 1;
-                        if ((ct = b-jb) > 0)
-                          { kptr[ap & BMASK] += ct;
-                            for (c = jb; c < b; c++)
-                              { hits[nhits].bread = bsort[c].read;
-                                hits[nhits].aread = ar;
-                                hits[nhits].apos  = ap; 
-                                hits[nhits].diag  = ap - bsort[c].rpos;
-                                nhits += 1;
-                              }
-                          }
-                      }
-                }
-              ca = da;
-              cb = db;
-            }
+              if (fused)
+                { if (ct < limit && nhits + ct > hend
+                                 && (hits = fuse_chunk(data,nhits,ct,&hend)) == NULL)
+                    { over = 1;
+                      break;
+                    }
+                  total += ct;
+                  if (ct < MAXGRAM)
+                    gram[ct] += 1;
+                }
+
+              if (ct < limit)
+                { b = jb;
+                  if (IDENTITY)
+                    for (a = ja; a < ia; a++)
+                      { ap = PK_RPOS(asort[a],apmk);
+                        ar = PK_READ(asort[a],arsh,armk);
+                        if (MG_comp)
+                          { while (b < ib && PK_READ(bsort[b],brsh,brmk) <= ar)
+                              b += 1;
+                          }
+                        else
+                          { while (b < ib && PK_READ(bsort[b],brsh,brmk) < ar)
+                              b += 1;
+                            while (b < ib && PK_READ(bsort[b],brsh,brmk) == ar
+                                      && PK_RPOS(bsort[b],bpmk) < ap)
+                              b += 1;
+                          }
+                        if ((ct = b-jb) > 0 && ar >= MG_rlo && ar < MG_rhi)
+                          { kptr[ap & BMASK] += ct;
+                            for (c = jb; c < b; c++)
+                              { hits[nhits].bread = PK_READ(bsort[c],brsh,brmk);
+                                hits[nhits].aread = ar;
+                                hits[nhits].apos  = ap; 
+                                hits[nhits].diag  = ap - PK_RPOS(bsort[c],bpmk);
+                                nhits += 1;
+                              }
+                          }
+                      }
+                  else
+                    for (a = ja; a < ia; a++)
+                      { ap = PK_RPOS(asort[a],apmk);
+                        ar = PK_READ(asort[a],arsh,armk);
+                        while (b < ib && PK_READ(bsort[b],brsh,brmk) < ar)
+                          b += 1;
+                        if ((ct = b-jb) > 0 && ar >= MG_rlo && ar < MG_rhi)
+                          { kptr[ap & BMASK] += ct;
+                            for (c = jb; c < b; c++)
+                              { hits[nhits].bread = PK_READ(bsort[c],brsh,brmk);
+                                hits[nhits].aread = ar;
+                                hits[nhits].apos  = ap; 
+                                hits[nhits].diag  = ap - PK_RPOS(bsort[c],bpmk);
+                                nhits += 1;
+                              }
+                          }
+                      }
+                }
+              ca = da;
+              cb = db;
+            }
+        }
+    }
+  else
+    { while (1)
+        { while (cb < ca)
+            cb = PK_CODE(bsort[++ib]);
+          while (cb > ca)
+            ca = PK_CODE(asort[++ia]);
+          if (cb == ca)
+            { if (ia >= aend) break;
+              ja = ia++;
+              while ((da = PK_CODE(asort[ia])) == ca)
+                ia += 1;
+              jb = ib++;
+              while ((db = PK_CODE(bsort[ib])) == cb)
+                ib += 1;
+
+              if (ia > aend)
+                { if (ja >= aend)
+                    break;
+                  da = PK_CODE(asort[ia = aend]);
+                  db = PK_CODE(bsort[ib = data->bend]);
+                }
+
+              ct = ib-jb;
+              if (fused)
+                { int64 pt = (ia-ja)*ct;
+
+                  if (pt < limit && nhits + pt > hend
+                                 && (hits = fuse_chunk(data,nhits,pt,&hend)) == NULL)
+                    { over = 1;
+                      break;
+                    }
+                  total += pt;
+                  if (pt < MAXGRAM)
+                    gram[pt] += 1;
+                }
+
+              if ((ia-ja)*ct < limit)
+                { for (a = ja; a < ia; a++)
+                    { ap = PK_RPOS(asort[a],apmk);
+                      ar = PK_READ(asort[a],arsh,armk);
+                      if (ar < MG_rlo || ar >= MG_rhi)
+                        continue;
+                      kptr[ap & BMASK] += ct;
+                      for (b = jb; b < ib; b++)
+                        { hits[nhits].bread = PK_READ(bsort[b],brsh,brmk);
+                          hits[nhits].aread = ar;
+                          hits[nhits].apos  = ap;
+                          hits[nhits].diag  = ap - PK_RPOS(bsort[b],bpmk);
+                          nhits += 1;
+                        }
+                    }
+                }
+              ca = da;
+              cb = db;
+            }
+        }
+    }
+
+  //  In FUSED mode if the budget ran out then the rest of the range is counted from the group
+  //    that did not fit.  Either way nhits is the count count_thread gives, and hend is set to
+  //    the number of hits produced in case no thread ran out.
+
+  if (fused)
+    { if (over)
+        { int sa = data->abeg;
+          int sb = data->bbeg;
+
+          data->abeg = ja;
+          data->bbeg = jb;
+          count_packed_thread(data);
+          data->nhits += total;
+          data->abeg = sa;
+          data->bbeg = sb;
+        }
+      else
+        { data->nhits = total;
+          data->hend  = nhits;
+        }
+    }
+
+  return (NULL);
+}
+
+  //  CANONICAL mode: the forward and reverse hits of a pair of canonical indices are found in
+  //    a single pass.  A group of entries with the same canonical k-mer consists of a block of
+  //    forward (o = 0) entries followed by a block of reverse complemented (o = 1) entries in
+  //    each list.  Forward hits pair blocks of like orientation and reverse hits pair blocks
+  //    of opposite orientation (or the o = 0 blocks with each other if the k-mer is its own
+  //    reverse complement).  The position of a B-entry in the complement of its read is
+  //    blen - rpos + Kspan - 2, and the entries of a B-block are emitted in reverse so that
+  //    pairs come out in exactly the order of a merge against the index of c(B).
+  //
+  //  The "primary" hits, those of the orientation comp, go to MG_hits as in merge_thread.  If
+  //    MG_chits is not NULL (only when comp = 0) the reverse hits are also produced and go
+  //    to it, so that the call for c(B) need not repeat the merge (see Match_Filter).
+
+static SeedPair  *MG_chits;
+static DAZZ_READ *MG_breads;
+
+static inline uint64 mg_acode(int i)
+{ return (MG_apk != NULL ? PK_CODE(MG_apk[i]) : MG_alist[i].code); }
+
+static inline uint64 mg_bcode(int i)
+{ return (MG_bpk != NULL ? PK_CODE(MG_bpk[i]) : MG_blist[i].code); }
+
+static inline int mg_aread(int i)
+{ return (MG_apk != NULL ? PK_READ(MG_apk[i],MG_arshift,MG_armask) : MG_alist[i].read); }
+
+static inline int mg_bread(int i)
+{ return (MG_bpk != NULL ? PK_READ(MG_bpk[i],MG_brshift,MG_brmask) : MG_blist[i].read); }
+
+static inline int mg_arpos(int i)
+{ return (MG_apk != NULL ? PK_RPOS(MG_apk[i],(1llu << MG_arshift)-1) : MG_alist[i].rpos); }
+
+static inline int mg_brpos(int i)
+{ return (MG_bpk != NULL ? PK_RPOS(MG_bpk[i],(1llu << MG_brshift)-1) : MG_blist[i].rpos); }
+
+static int is_palindrome(uint64 c)
+{ uint64 r, x;
+  int    i;
+
+  if (Kmer & 0x1)
+    return (0);
+  r = 0;
+  x = c;
+  for (i = 0; i < Kmer; i++)
+    { r  = (r << 2) | (3 - (x & 0x3));
+      x >>= 2;
+    }
+  return (r == c);
+}
+
+  //  Advance b past the B-entries in [b,ib) that may be paired with A-entry (ar,ap) in the
+  //    self comparison of a block (the same rules as in count_thread & merge_thread)
+
+static inline int self_prefix(int b, int ib, int ar, int ap, int comp)
+{ if (comp && IDENTITY)
+    { while (b < ib && mg_bread(b) <= ar)
+        b += 1;
+    }
+  else
+    { while (b < ib && mg_bread(b) < ar)
+        b += 1;
+      if (IDENTITY)
+        while (b < ib && mg_bread(b) == ar && mg_brpos(b) < ap)
+          b += 1;
+    }
+  return (b);
+}
+
+static int64 canon_count(int ja, int ia, int jb, int ib, int comp)
+{ int64 ct;
+  int   a, b;
+
+  if ( ! MG_self)
+    return (((int64) (ia-ja)) * (ib-jb));
+  ct = 0;
+  b  = jb;
+  for (a = ja; a < ia; a++)
+    { b = self_prefix(b,ib,mg_aread(a),mg_arpos(a),comp);
+      ct += (b-jb);
+    }
+  return (ct);
+}
+
+static int64 canon_emit(int ja, int ia, int jb, int ib, int comp,
+                        SeedPair *hits, int64 nhits, int64 *kptr)
+{ int64 ct;
+  int   a, b, c;
+  int   ar, ap, br;
+
+  b = ib;
+  if (MG_self)
+    b = jb;
+  for (a = ja; a < ia; a++)
+    { ap = mg_arpos(a);
+      ar = mg_aread(a);
+      if (MG_self)
+        b = self_prefix(b,ib,ar,ap,comp);
+      if ((ct = b-jb) > 0 && ar >= MG_rlo && ar < MG_rhi)
+        { kptr[ap & BMASK] += ct;
+          if (comp)
+            for (c = b-1; c >= jb; c--)
+              { br = mg_bread(c);
+                hits[nhits].bread = br;
+                hits[nhits].aread = ar;
+                hits[nhits].apos  = ap;
+                hits[nhits].diag  = ap - ((MG_breads[br].rlen + Kspan - 2) - mg_brpos(c));
+                nhits += 1;
+              }
+          else
+            for (c = jb; c < b; c++)
+              { hits[nhits].bread = mg_bread(c);
+                hits[nhits].aread = ar;
+                hits[nhits].apos  = ap;
+                hits[nhits].diag  = ap - mg_brpos(c);
+                nhits += 1;
+              }
+        }
+    }
+  return (nhits);
+}
+
+  //  Find the next group of canonical k-mer c in each list, setting x[0..2] and y[0..2] to the
+  //    boundaries of its blocks.  Return 1 if c is a palindrome, 0 if not, and -1 when done.
+
+static int canon_group(int *pa, int *pb, int aend, int *x, int *y)
+{ uint64 ca, cb, f, r;
+  int    ia, ib;
+
+  ia = *pa;
+  ib = *pb;
+  ca = mg_acode(ia) >> 1;
+  cb = mg_bcode(ib) >> 1;
+  while (cb != ca)
+    { while (cb < ca)
+        cb = mg_bcode(++ib) >> 1;
+      while (cb > ca)
+        ca = mg_acode(++ia) >> 1;
+    }
+  if (ia >= aend)
+    return (-1);
+
+  f = (ca << 1);
+  r = f | 0x1;
+  x[0] = ia;
+  while (mg_acode(ia) == f)
+    ia += 1;
+  x[1] = ia;
+  while (mg_acode(ia) == r)
+    ia += 1;
+  x[2] = *pa = ia;
+  y[0] = ib;
+  while (mg_bcode(ib) == f)
+    ib += 1;
+  y[1] = ib;
+  while (mg_bcode(ib) == r)
+    ib += 1;
+  y[2] = *pb = ib;
+
+  return (x[1] == x[2] && y[1] == y[2] && is_palindrome(ca));
+}
+
+static void *count_canon_thread(void *arg)
+{ Merge_Arg  *data  = (Merge_Arg *) arg;
+  int64      *gram  = data->hitgram;
+  int64      *cgram = data->cgram;
+  int64       nhits = 0;
+  int64       chits = 0;
+  int         aend  = data->aend;
+
+  int64  ct;
+  int    ia, ib, o, q;
+  int    x[3], y[3];
+  int    pal;
+
+  ia = data->abeg;
+  ib = data->bbeg;
+  while ((pal = canon_group(&ia,&ib,aend,x,y)) >= 0)
+    { if ( ! MG_comp)
+        for (o = 0; o < 2; o++)
+          if (x[o] < x[o+1] && y[o] < y[o+1])
+            { ct = canon_count(x[o],x[o+1],y[o],y[o+1],0);
+              nhits += ct;
+              if (ct < MAXGRAM)
+                gram[ct] += 1;
+            }
+      if (MG_comp || cgram != NULL)
+        for (o = 0; o < 2-pal; o++)
+          { q = (pal ? o : 1-o);
+            if (x[o] < x[o+1] && y[q] < y[q+1])
+              { ct = canon_count(x[o],x[o+1],y[q],y[q+1],1);
+                if (MG_comp)
+                  { nhits += ct;
+                    if (ct < MAXGRAM)
+                      gram[ct] += 1;
+                  }
+                else
+                  { chits += ct;
+                    if (ct < MAXGRAM)
+                      cgram[ct] += 1;
+                  }
+              }
+          }
+    }
+
+  data->nhits = nhits;
+  data->chits = chits;
+
+  return (NULL);
+}
+
+static void *merge_canon_thread(void *arg)
+{ Merge_Arg  *data  = (Merge_Arg *) arg;
+  int64       nhits = data->nhits;
+  int64       chits = data->chits;
+  int         aend  = data->aend;
+  int         limit = data->limit;
+  int         climit = data->climit;
+
+  int64  ct;
+  int    ia, ib, o, q;
+  int    x[3], y[3];
+  int    pal;
+
+  ia = data->abeg;
+  ib = data->bbeg;
+  while ((pal = canon_group(&ia,&ib,aend,x,y)) >= 0)
+    { if ( ! MG_comp)
+        for (o = 0; o < 2; o++)
+          if (x[o] < x[o+1] && y[o] < y[o+1])
+            { ct = canon_count(x[o],x[o+1],y[o],y[o+1],0);
+              if (ct < limit)
+                nhits = canon_emit(x[o],x[o+1],y[o],y[o+1],0,MG_hits,nhits,data->kptr);
+            }
+      if (MG_comp || MG_chits != NULL)
+        for (o = 0; o < 2-pal; o++)
+          { q = (pal ? o : 1-o);
+            if (x[o] < x[o+1] && y[q] < y[q+1])
+              { ct = canon_count(x[o],x[o+1],y[q],y[q+1],1);
+                if (MG_comp)
+                  { if (ct < limit)
+                      nhits = canon_emit(x[o],x[o+1],y[q],y[q+1],1,MG_hits,nhits,data->kptr);
+                  }
+                else
+                  { if (ct < climit)
+                      chits = canon_emit(x[o],x[o+1],y[q],y[q+1],1,MG_chits,chits,data->ckptr);
+                  }
+              }
+          }
+    }
+
+  return (NULL);
+}
+
+  //  SLABS mode: tally the hits of each A-read (in the orientation comp) in data->rcnt so
+  //    that Match_Filter can partition the A-reads into slabs whose hits fit in memory
+
+static void slab_tally(int ja, int ia, int jb, int ib, int comp, int64 *rcnt)
+{ int a, b, ar;
+
+  b = jb;
+  for (a = ja; a < ia; a++)
+    { ar = mg_aread(a);
+      if (MG_self)
+        { b = self_prefix(b,ib,ar,mg_arpos(a),comp);
+          rcnt[ar] += (b-jb);
         }
+      else
+        rcnt[ar] += (ib-jb);
+    }
+}
+
+static void *slab_count_thread(void *arg)
+{ Merge_Arg  *data  = (Merge_Arg *) arg;
+  int64      *rcnt  = data->rcnt;
+  int         aend  = data->aend;
+
+  int    ia, ib;
+  int    ja, jb;
+  uint64 ca, cb;
+  int    x[3], y[3];
+  int    o, q, pal;
+
+  ia = data->abeg;
+  ib = data->bbeg;
+  if (CANONICAL)
+    { while ((pal = canon_group(&ia,&ib,aend,x,y)) >= 0)
+        for (o = 0; o < 2 - (pal && MG_comp); o++)
+          { q = ((MG_comp && ! pal) ? 1-o : o);
+            if (x[o] < x[o+1] && y[q] < y[q+1])
+              slab_tally(x[o],x[o+1],y[q],y[q+1],MG_comp,rcnt);
+          }
     }
   else
-    { while (1)
+    { ca = mg_acode(ia);
+      cb = mg_bcode(ib);
+      while (1)
         { while (cb < ca)
-            cb = bsort[++ib].code;
+            cb = mg_bcode(++ib);
           while (cb > ca)
-            ca = asort[++ia].code;
+            ca = mg_acode(++ia);
           if (cb == ca)
             { if (ia >= aend) break;
               ja = ia++;
-              while ((da = asort[ia].code) == ca)
+              while (mg_acode(ia) == ca)
                 ia += 1;
               jb = ib++;
-              while ((db = bsort[ib].code) == cb)
+              while (mg_bcode(ib) == cb)
                 ib += 1;
 
               if (ia > aend)
-                { if (ja >= aend)
-                    break;
-                  da = asort[ia = aend].code;
-                  db = bsort[ib = data->bend].code;
+                { ia = aend;
+                  ib = data->bend;
                 }
 
-              ct = ib-jb;
-              if ((ia-ja)*ct < limit)
-                { for (a = ja; a < ia; a++)
-                    { ap = asort[a].rpos;
-                      kptr[ap & BMASK] += ct;
-                      for (b = jb; b < ib; b++)
-                        { hits[nhits].bread = bsort[b].read;
-                          hits[nhits].aread = asort[a].read;
-                          hits[nhits].apos  = ap;
-                          hits[nhits].diag  = ap - bsort[b].rpos;
-                          nhits += 1;
-                        }
-                    }
-                }
-              ca = da;
-              cb = db;
+              slab_tally(ja,ia,jb,ib,MG_comp,rcnt);
+
+              ca = mg_acode(ia);
+              cb = mg_bcode(ib);
             }
         }
     }
@@ -1957,36 +4949,226 @@ void Diagonal_Span(Path *path, int *mind, int *maxd)
   *maxd = (hgh >> Binshift)+1;
 }
 
+  //  The hits of each thread's segment are split at read pair boundaries into REPORT_CHUNKS
+  //    chunks.  Threads claim chunks from the front of their own segment and when it is
+  //    exhausted steal them from the back of the others'.  The overlaps of a chunk are
+  //    written to a memory stream and committed to the .las files of the segment's owner in
+  //    chunk order, so the files are exactly those of a static partition.
+
+#define REPORT_CHUNKS  16
+
 typedef struct
-  { int64       beg, end;
-    int        *score;
-    int        *lastp;
-    int        *lasta;
-    Work_Data  *work;
-    FILE       *ofile1;
-    FILE       *ofile2;
-    int64       nfilt;
-    int64       ncheck;
+  { int64       beg, end;   //  Hit range of the chunk
+    int         owner;      //  Index of the thread whose segment (and files) it belongs to
+    int         done;       //  Processed and awaiting commit
+    int64       ahits;      //  # of overlaps in each output
+    int64       bhits;
+    char       *buf1;       //  Memory streams of the overlaps for ofile1 and ofile2
+    char       *buf2;
+    size_t      len1;
+    size_t      len2;
+  } Report_Chunk;
+
+  //  The diagonal band of a pair of reads is binned by diag >> Binshift.  All the state of a
+  //    bin is kept in one 16-byte cell so that scoring a hit, testing it against its two
+  //    neighbors, and checking it against the alignments found, touch one or two cache
+  //    lines rather than a line in each of three separate arrays.
+
+typedef struct
+  { int score;     //  Coverage of the bin by the k-mers of the hits of the current panel
+    int lastp;     //  A-position of the last such hit in the bin
+    int lasta;     //  Furthest A-end of an alignment through the bin for the current pair
+    int pad;
+  } Diag_Bin;
+
+typedef struct
+  { int64            beg, end;
+    Diag_Bin        *band;     //  band[mindiag-1..maxdiag+1]
+    int             *hsum;     //  Scratch for the hits of a panel, of size hmax (see hot_hits)
+    int             *hot;
+    int              hmax;
+    char            *cseq;     //  If MG_comp, the complement of B-read cread (see comp_bseq),
+                               //    padded as Local_Alignment requires
+    int              cread;
+    Work_Data       *work;
+    FILE            *ofile1;
+    FILE            *ofile2;
+    int64            nfilt;
+    int64            ncheck;
+    int64            mhpair;   //  # of pairs with overlaps, and those -j would prune (if MHAUDIT)
+    int64            mhlost;
+    int              tnum;
+    volatile uint64  claim;    //  Unclaimed chunks of segment are [claim >> 32, claim & 0xffffffff)
+    int              commit;   //  Next chunk of segment to be written to the files
+    int              cend;     //  End of the segment's chunks
+    pthread_mutex_t  lock;     //  Guards commit and the files
+    int64            off1;     //  Offsets in ofile1 and ofile2 of the next chunk committed
+    int64            off2;
+    int64            ahits;    //  # of overlaps written to ofile1 and ofile2
+    int64            bhits;
+    int              AOmax;    //  Scratch of the thread carried between its chunks
+    int              BOmax;
+    Path            *amatch;
+    Path            *bmatch;
+    Trace_Buffer     tbuf;
   } Report_Arg;
 
-static void *report_thread(void *arg)
-{ Report_Arg  *data   = (Report_Arg *) arg;
-  SeedPair    *hits   = MR_hits;
+static Report_Arg   *MR_parm;
+static Report_Chunk *MR_chunk;
+
+  //  Set hot to the indices, in order, of the len hits of a panel whose bin together with
+  //    the better of its two neighbors scores Hitmin or more, and return their number.  The
+  //    sums are gathered into sum and then compared with Hitmin 4 at a time if SSE2 is at hand.
+
+static int hot_hits(Diag_Bin *band, SeedPair *hits, int len, int *sum, int *hot)
+{ Diag_Bin *b;
+  int       i, n;
+
+  for (i = 0; i < len; i++)
+    { b = band + (hits[i].diag >> Binshift);
+      if (b[-1].score > b[1].score)
+        sum[i] = b->score + b[-1].score;
+      else
+        sum[i] = b->score + b[1].score;
+    }
+
+  n = 0;
+  i = 0;
+#ifdef __SSE2__
+  { __m128i thresh = _mm_set1_epi32(Hitmin-1);
+    int     m;
+
+    for ( ; i+4 <= len; i += 4)
+      { m = _mm_movemask_ps(_mm_castsi128_ps(
+                 _mm_cmpgt_epi32(_mm_loadu_si128((__m128i *) (sum+i)),thresh)));
+        while (m != 0)
+          { hot[n++] = i + __builtin_ctz(m);
+            m &= m-1;
+          }
+      }
+  }
+#endif
+  for ( ; i < len; i++)
+    if (sum[i] >= Hitmin)
+      hot[n++] = i;
+
+  return (n);
+}
+
+  //  The B-block is only ever held in the forward orientation, the complement of a B-read
+  //    being made in a buffer of the thread when a pair involving it is first aligned.  The
+  //    cost is a pass over the B-read per pair aligned, small next to the alignment itself.
+
+static char *comp_bseq(Report_Arg *data, char *bseq, int br)
+{ DAZZ_READ *r = MR_bblock->reads + br;
+
+  if (data->cread != br)
+    { complement_read(data->cseq,bseq + r->boff,r->rlen);
+      data->cread = br;
+    }
+  return (data->cseq+1);
+}
+
+  //  Set up align, ovla, and ovlb for aligning A-read ar against B-read br, and whether
+  //    overlaps are to be output for A (*doA) and for B (*doB)
+
+static void set_pair(Report_Arg *data, Alignment *align, Overlap *ovla, Overlap *ovlb,
+                     int ar, int br, int *doA, int *doB)
+{ DAZZ_READ *aread = MR_ablock->reads;
+  DAZZ_READ *bread = MR_bblock->reads;
+  int        alen  = aread[ar].rlen;
+  int        blen  = bread[br].rlen;
+
+  align->aseq = ((char *) (MR_ablock->bases)) + aread[ar].boff;
+  if (MG_comp)
+    align->bseq = comp_bseq(data,(char *) (MR_bblock->bases),br);
+  else
+    align->bseq = ((char *) (MR_bblock->bases)) + bread[br].boff;
+  align->alen = alen;
+  align->blen = blen;
+  ovlb->bread = ovla->aread = ar + MR_ablock->tfirst;
+  ovlb->aread = ovla->bread = br + MR_bblock->tfirst;
+#ifdef FOR_PACBIO
+  *doA = 1;
+  *doB = (SYMMETRIC && (ar != br || !MG_self || !MG_comp));
+#else
+  *doA = (alen >= HGAP_MIN);
+  *doB = (SYMMETRIC && blen >= HGAP_MIN && (ar != br || !MG_self || !MG_comp));
+#endif
+}
+
+  //  Remove the redundant overlaps of the novla local alignments in amatch and novlb in
+  //    bmatch found for the pair set up in align, ovla, and ovlb, and write the remainder
+  //    to ofile1 and ofile2, adding their number to *ahits and *bhits
+
+static void write_pair(Report_Arg *data, Path *amatch, int novla, Path *bmatch, int novlb,
+                       Alignment *align, Overlap *ovla, Overlap *ovlb,
+                       FILE *ofile1, FILE *ofile2, int64 *ahits, int64 *bhits)
+{ Trace_Buffer *tbuf = &(data->tbuf);
+  Work_Data    *work = data->work;
+  int           small, tbytes;
+  int           i;
+
+  if (MR_tspace <= TRACE_XOVR)
+    { small  = 1;
+      tbytes = sizeof(uint8);
+    }
+  else
+    { small  = 0;
+      tbytes = sizeof(uint16);
+    }
+
+#ifdef TEST_CONTAIN
+  if (novla > 1 || novlb > 1)
+    printf("\n%5d vs %5d:\n",ovla->aread,ovla->bread);
+#endif
+
+  if (novla > 1)
+    { if (novlb > 1)
+        novla = novlb = Handle_Redundancies(amatch,novla,bmatch,align,work,tbuf);
+      else
+        novla = Handle_Redundancies(amatch,novla,NULL,align,work,tbuf);
+    }
+  else if (novlb > 1)
+    novlb = Handle_Redundancies(bmatch,novlb,NULL,align,work,tbuf);
+
+  for (i = 0; i < novla; i++)
+    { ovla->path = amatch[i];
+      ovla->path.trace = tbuf->trace + (uint64) (ovla->path.trace);
+      if (small)
+        Compress_TraceTo8(ovla,1);
+      if (Write_Overlap(ofile1,ovla,tbytes))
+        { fprintf(stderr,"%s: Cannot write to %s too small?\n",SORT_PATH,Prog_Name);
+          Clean_Exit(1);
+        }
+    }
+  for (i = 0; i < novlb; i++)
+    { ovlb->path = bmatch[i];
+      ovlb->path.trace = tbuf->trace + (uint64) (ovlb->path.trace);
+      if (small)
+        Compress_TraceTo8(ovlb,1);
+      if (Write_Overlap(ofile2,ovlb,tbytes))
+        { fprintf(stderr,"%s: Cannot write to %s, too small?\n",SORT_PATH,Prog_Name);
+          Clean_Exit(1);
+        }
+    }
+  *ahits += novla;
+  *bhits += novlb;
+
+  if (MHAUDIT && MH_cbeg != NULL && novla + novlb > 0)
+    { data->mhpair += 1;
+      if ( ! mh_candidate(ovla->aread - MR_ablock->tfirst,ovla->bread - MR_bblock->tfirst))
+        data->mhlost += 1;
+    }
+}
+
+static void report_chunk(Report_Arg *data, Report_Chunk *chunk, FILE *ofile1, FILE *ofile2)
+{ SeedPair    *hits   = MR_hits;
   Double      *hitd   = (Double *) MR_hits;
-  char        *aseq   = (char *) (MR_ablock->bases);
-  char        *bseq   = (char *) (MR_bblock->bases);
   DAZZ_READ   *aread  = MR_ablock->reads;
   DAZZ_READ   *bread  = MR_bblock->reads;
-  int         *score  = data->score;
-  int         *scorp  = data->score + 1;
-  int         *scorm  = data->score - 1;
-  int         *lastp  = data->lastp;
-  int         *lasta  = data->lasta;
+  Diag_Bin    *band   = data->band;
   Work_Data   *work   = data->work;
-  FILE        *ofile1 = data->ofile1;
-  FILE        *ofile2 = data->ofile2;
-  int          afirst = MR_ablock->tfirst;
-  int          bfirst = MR_bblock->tfirst;
   int          maxdiag = ( MR_ablock->maxlen >> Binshift);
   int          mindiag = (-MR_bblock->maxlen >> Binshift);
 
@@ -1998,13 +5180,12 @@ static void *report_thread(void *arg)
   int64        nfilt = 0;
   int64        ahits = 0;
   int64        bhits = 0;
-  int          small, tbytes;
 
   int    AOmax, BOmax;
   int    novla, novlb;
   Path  *amatch, *bmatch;
 
-  Trace_Buffer _tbuf, *tbuf = &_tbuf;
+  Trace_Buffer *tbuf = &(data->tbuf);
 
   Double *hitc;
   int     minhit;
@@ -2012,42 +5193,26 @@ static void *report_thread(void *arg)
   uint64  npair = 0;
   int64   nidx, eidx;
 
+  //  Write_Overlap writes the padding of an Overlap, so clear it for reproducible .las files
+
+  memset(ovla,0,sizeof(Overlap));
+  memset(ovlb,0,sizeof(Overlap));
+
   //  In ovl and align roles of A and B are reversed, as the B sequence must be the
   //    complemented sequence !!
 
   align->flags = ovla->flags = ovlb->flags = MG_comp;
   align->path  = apath;
 
-  if (MR_tspace <= TRACE_XOVR)
-    { small  = 1;
-      tbytes = sizeof(uint8);
-    }
-  else
-    { small  = 0;
-      tbytes = sizeof(uint16);
-    }
-
-  AOmax = BOmax = MATCH_CHUNK;
-  amatch = Malloc(sizeof(Path)*AOmax,"Allocating match vector");
-  bmatch = Malloc(sizeof(Path)*BOmax,"Allocating match vector");
-
-  tbuf->max   = 2*TRACE_CHUNK;
-  tbuf->trace = Malloc(sizeof(short)*tbuf->max,"Allocating trace vector");
-
-  if (amatch == NULL || bmatch == NULL || tbuf->trace == NULL)
-    Clean_Exit(1);
-
-  fwrite(&ahits,sizeof(int64),1,ofile1);
-  fwrite(&MR_tspace,sizeof(int),1,ofile1);
-  if (MR_two)
-    { fwrite(&bhits,sizeof(int64),1,ofile2);
-      fwrite(&MR_tspace,sizeof(int),1,ofile2);
-    }
+  AOmax  = data->AOmax;
+  BOmax  = data->BOmax;
+  amatch = data->amatch;
+  bmatch = data->bmatch;
 
   minhit = (Hitmin-1)/Kmer + 1;
   hitc   = hitd + (minhit-1);
-  eidx   = data->end - minhit;
-  nidx   = data->beg;
+  eidx   = chunk->end - minhit;
+  nidx   = chunk->beg;
   for (cpair = hitd[nidx].p2; nidx <= eidx; cpair = npair)
     if (hitc[nidx].p2 != cpair)
       { nidx += 1;
@@ -2062,6 +5227,8 @@ static void *report_thread(void *arg)
         int   apos, bpos, diag;
         int64 lidx, sidx;
         int64 f, h2;
+        int   h, nhot;
+        Diag_Bin *b;
 
         ar = hits[nidx].aread;
         br = hits[nidx].bread;
@@ -2075,7 +5242,7 @@ static void *report_thread(void *arg)
           }
 
 #ifdef TEST_GATHER
-        printf("%5d vs %5d : %5d x %5d\n",br+bfirst,ar+afirst,blen,alen);
+        printf("%5d vs %5d : %5d x %5d\n",br+MR_bblock->tfirst,ar+MR_ablock->tfirst,blen,alen);
 #endif
         setaln = 1;
         doA = doB = 0;
@@ -2099,56 +5266,53 @@ static void *report_thread(void *arg)
 
             for (f = lidx; f < nidx; f++)
               { apos = hits[f].apos;
-                diag = hits[f].diag >> Binshift;
-                if (apos - lastp[diag] >= Kmer)
-                  score[diag] += Kmer;
+                b    = band + (hits[f].diag >> Binshift);
+                if (apos - b->lastp >= Kmer)
+                  b->score += Kmer;
                 else
-                  score[diag] += apos - lastp[diag];
-                lastp[diag] = apos;
+                  b->score += apos - b->lastp;
+                b->lastp = apos;
+              }
+
+            if (nidx-lidx > data->hmax)
+              { data->hmax = 1.2*(nidx-lidx) + HOT_CHUNK;
+                data->hsum = (int *) Realloc(data->hsum,sizeof(int)*data->hmax,
+                                             "Reallocating hit scores");
+                data->hot  = (int *) Realloc(data->hot,sizeof(int)*data->hmax,
+                                             "Reallocating hit scores");
+                if (data->hsum == NULL || data->hot == NULL)
+                  Clean_Exit(1);
               }
+            nhot = hot_hits(band,hits+lidx,nidx-lidx,data->hsum,data->hot);
 
 #ifdef TEST_GATHER
             printf("  %6lld upto %6d",nidx-lidx,amark);
 #endif
 
-            for (f = lidx; f < nidx; f++)
-              { apos = hits[f].apos;
+            for (h = 0; h < nhot; h++)
+              { f    = lidx + data->hot[h];
+                apos = hits[f].apos;
                 diag = hits[f].diag;
                 bpos = apos - diag;
                 diag = diag >> Binshift;
-                if (apos > lasta[diag] &&
-                     (score[diag] + scorp[diag] >= Hitmin || score[diag] + scorm[diag] >= Hitmin))
+                if (apos > band[diag].lasta)
                   { if (setaln)
                       { setaln = 0;
-                        align->aseq = aseq + aread[ar].boff;
-                        align->bseq = bseq + bread[br].boff;
-                        align->alen = alen;
-                        align->blen = blen;
-                        ovlb->bread = ovla->aread = ar + afirst;
-                        ovlb->aread = ovla->bread = br + bfirst;
-#ifdef FOR_PACBIO
-                        doA = 1;
-                        doB = (SYMMETRIC && (ar != br || !MG_self || !MG_comp));
-#else
-                        doA = (alen >= HGAP_MIN);
-                        doB = (SYMMETRIC && blen >= HGAP_MIN &&
-                                   (ar != br || !MG_self || !MG_comp));
-#endif
+                        set_pair(data,align,ovla,ovlb,ar,br,&doA,&doB);
                       }
 #ifdef TEST_GATHER
                     else
                       printf("\n                    ");
 
-                    if (scorm[diag] > scorp[diag])
-                      printf("  %5d.. x %5d.. %5d (%3d)",
-                             bpos,apos,apos-bpos,score[diag]+scorm[diag]);
-                    else
-                      printf("  %5d.. x %5d.. %5d (%3d)",
-                             bpos,apos,apos-bpos,score[diag]+scorp[diag]);
+                    printf("  %5d.. x %5d.. %5d (%3d)",
+                           bpos,apos,apos-bpos,data->hsum[data->hot[h]]);
 #endif
                     nfilt += 1;
 
 #ifdef DO_ALIGNMENT
+                    //  The hits of a pair are aligned one at a time as whether a hit is tried
+                    //    depends on the lasta's set by the alignments found before it
+
                     bpath = Local_Alignment(align,work,MR_spec,apos-bpos,apos-bpos,apos+bpos,-1,-1);
 
                     { int low, hgh, ae;
@@ -2160,8 +5324,8 @@ static void *report_thread(void *arg)
                         hgh = diag;
                       ae = apath->aepos;
                       for (diag = low; diag <= hgh; diag++)
-                        if (ae > lasta[diag])
-                          lasta[diag] = ae;
+                        if (ae > band[diag].lasta)
+                          band[diag].lasta = ae;
 #ifdef TEST_GATHER
                       printf(" %d - %d @ %d",low,hgh,apath->aepos);
 #endif
@@ -2238,8 +5402,8 @@ static void *report_thread(void *arg)
               }
 
             for (f = lidx; f < nidx; f++)
-              { diag = hits[f].diag >> Binshift;
-                score[diag] = lastp[diag] = 0;
+              { b = band + (hits[f].diag >> Binshift);
+                b->score = b->lastp = 0;
               }
 #ifdef TEST_GATHER
             printf("\n");
@@ -2251,79 +5415,404 @@ static void *report_thread(void *arg)
 
             diag = hits[f].diag >> Binshift;
             for (d = diag; d <= maxdiag; d++)
-              if (lasta[d] == 0)
+              if (band[d].lasta == 0)
                 break;
               else
-                lasta[d] = 0;
+                band[d].lasta = 0;
             for (d = diag-1; d >= mindiag; d--)
-              if (lasta[d] == 0)
+              if (band[d].lasta == 0)
                 break;
               else
-                lasta[d] = 0;
+                band[d].lasta = 0;
           }
 
-         
-         { int i;
+        write_pair(data,amatch,novla,bmatch,novlb,align,ovla,ovlb,ofile1,ofile2,&ahits,&bhits);
+      }
+
+  data->AOmax  = AOmax;
+  data->BOmax  = BOmax;
+  data->amatch = amatch;
+  data->bmatch = bmatch;
+
+  data->nfilt  += nfilt;
+  data->ncheck += ahits + bhits;
+
+  chunk->ahits = ahits;
+  chunk->bhits = bhits;
+}
+
+  //  Claim the next chunk of thread tnum's segment, or failing that steal the last chunk of
+  //    another thread's segment.  Return -1 if there is no work left.
+
+static int claim_chunk(int tnum)
+{ Report_Arg *parm;
+  uint64      c, n, e;
+  int         i, t;
+
+  for (i = 0; i < NTHREADS; i++)
+    { t    = (tnum + i) % NTHREADS;
+      parm = MR_parm + t;
+      while (1)
+        { c = parm->claim;
+          n = (c >> 32);
+          e = (c & 0xffffffffllu);
+          if (n >= e)
+            break;
+          if (i == 0)
+            { if (__sync_bool_compare_and_swap(&(parm->claim),c,((n+1) << 32) | e))
+                return ((int) n);
+            }
+          else
+            { if (__sync_bool_compare_and_swap(&(parm->claim),c,(n << 32) | (e-1)))
+                return ((int) (e-1));
+            }
+        }
+    }
+  return (-1);
+}
+
+  //  Mark chunk c done and commit every finished chunk at the head of its owner's queue:
+  //    appended to the memory streams if ORDERED, otherwise queued to the overlap writer
+
+static void commit_chunk(int c)
+{ Report_Chunk *chunk = MR_chunk + c;
+  Report_Arg   *own   = MR_parm + chunk->owner;
+
+  pthread_mutex_lock(&(own->lock));
+  chunk->done = 1;
+  while (own->commit < own->cend && MR_chunk[own->commit].done)
+    { chunk = MR_chunk + own->commit;
+      if (ORDERED)
+        { if (fwrite(chunk->buf1,1,chunk->len1,own->ofile1) != chunk->len1 ||
+              (MR_two && fwrite(chunk->buf2,1,chunk->len2,own->ofile2) != chunk->len2))
+            { fprintf(stderr,"%s: Cannot write to %s, too small?\n",Prog_Name,SORT_PATH);
+              Clean_Exit(1);
+            }
+          free(chunk->buf1);
+          free(chunk->buf2);
+        }
+      else
+        { write_queue(fileno(own->ofile1),own->off1,chunk->buf1,chunk->len1);
+          own->off1 += chunk->len1;
+          if (MR_two)
+            { write_queue(fileno(own->ofile2),own->off2,chunk->buf2,chunk->len2);
+              own->off2 += chunk->len2;
+            }
+          else
+            free(chunk->buf2);
+        }
+      chunk->buf1 = chunk->buf2 = NULL;
+      own->ahits += chunk->ahits;
+      own->bhits += chunk->bhits;
+      own->commit += 1;
+    }
+  pthread_mutex_unlock(&(own->lock));
+}
+
+static void *report_thread(void *arg)
+{ Report_Arg   *data = (Report_Arg *) arg;
+  Report_Chunk *chunk;
+  FILE         *ofile1, *ofile2;
+  int           c;
+
+  data->AOmax  = data->BOmax = MATCH_CHUNK;
+  data->amatch = Malloc(sizeof(Path)*data->AOmax,"Allocating match vector");
+  data->bmatch = Malloc(sizeof(Path)*data->BOmax,"Allocating match vector");
+
+  data->tbuf.max   = 2*TRACE_CHUNK;
+  data->tbuf.trace = Malloc(sizeof(short)*data->tbuf.max,"Allocating trace vector");
+
+  data->hmax = HOT_CHUNK;
+  data->hsum = (int *) Malloc(sizeof(int)*data->hmax,"Allocating hit scores");
+  data->hot  = (int *) Malloc(sizeof(int)*data->hmax,"Allocating hit scores");
+
+  data->cread = -1;
+  data->cseq  = NULL;
+  if (MG_comp)
+    data->cseq = (char *) Malloc(MR_bblock->maxlen+5,"Allocating complement buffer");
+
+  if (data->amatch == NULL || data->bmatch == NULL || data->tbuf.trace == NULL ||
+      data->hsum == NULL || data->hot == NULL || (MG_comp && data->cseq == NULL))
+    Clean_Exit(1);
+
+  while ((c = claim_chunk(data->tnum)) >= 0)
+    { chunk  = MR_chunk + c;
+      ofile1 = open_memstream(&(chunk->buf1),&(chunk->len1));
+      if (MR_two)
+        ofile2 = open_memstream(&(chunk->buf2),&(chunk->len2));
+      else
+        ofile2 = ofile1;
+      if (ofile1 == NULL || ofile2 == NULL)
+        { fprintf(stderr,"%s: Cannot open memory stream for overlaps\n",Prog_Name);
+          Clean_Exit(1);
+        }
+
+      report_chunk(data,chunk,ofile1,ofile2);
+
+      fclose(ofile1);
+      if (MR_two)
+        fclose(ofile2);
+      commit_chunk(c);
+    }
+
+  free(data->cseq);
+  free(data->hot);
+  free(data->hsum);
+  free(data->tbuf.trace);
+  free(data->bmatch);
+  free(data->amatch);
+
+  return (NULL);
+}
+
+
+
+/*******************************************************************************************
+ *
+ *  IN-MEMORY OVERLAP SORT (ORDERED)
+ *
+ ********************************************************************************************/
+
+  //  If ORDERED is set, each report thread's overlaps (in .las record format, but without the
+  //    header) are kept in memory for both orientations rather than written to SORT_PATH.
+  //    Write_Sorted_Overlaps then sorts each thread's records and merges them into the final
+  //    .las files exactly as LAsort and LAmerge would: the runs are ordered N1..NT, C1..CT and
+  //    ties are broken by run and then by position in the run.
+
+typedef struct
+  { char   *buf;      //  The records of a run and their number
+    size_t  len;
+    int64   novl;
+  } Ovl_Run;
+
+typedef struct
+  { int     aread;    //  Sort key of a record and its offset in its run
+    int     bread;
+    int     comp;
+    int     abpos;
+    int64   off;
+  } Ovl_Key;
+
+static Ovl_Run *OS_run = NULL;   //  OS_run[(2*o+comp)*NTHREADS+t] is thread t's run for output o
+static int      OS_two;          //  Are there two outputs (A.B and B.A)?
+static int      OS_tspace;
+
+static Ovl_Run *OS_krun;         //  The runs being merged, the keys of run r start at OS_kbeg[r]
+static Ovl_Key *OS_key;
+static int64   *OS_kbeg;
+static int      OS_map;
+
+static void init_runs(int comp)
+{ int i, o;
+
+  if (OS_run == NULL)
+    { OS_run = (Ovl_Run *) Malloc(sizeof(Ovl_Run)*4*MAXTHREADS,"Allocating overlap runs");
+      if (OS_run == NULL)
+        Clean_Exit(1);
+      for (i = 0; i < 4*MAXTHREADS; i++)
+        OS_run[i].buf = NULL;
+    }
+  for (o = 0; o < 2; o++)
+    for (i = 0; i < NTHREADS; i++)
+      { Ovl_Run *r = OS_run + (2*o+comp)*NTHREADS + i;
+
+        free(r->buf);
+        r->buf  = NULL;
+        r->len  = 0;
+        r->novl = 0;
+      }
+}
+
+static inline int key_cmp(Ovl_Key *l, Ovl_Key *r)
+{ if (l->aread != r->aread)
+    return (l->aread - r->aread);
+  if (l->bread != r->bread)
+    return (l->bread - r->bread);
+  if (l->comp != r->comp)
+    return (l->comp - r->comp);
+  return (l->abpos - r->abpos);
+}
+
+static int KEY_ORDER(const void *x, const void *y)
+{ Ovl_Key *l = (Ovl_Key *) x;
+  Ovl_Key *r = (Ovl_Key *) y;
+  int      c;
+
+  c = key_cmp(l,r);
+  if (c != 0)
+    return (c);
+  if (l->off < r->off)
+    return (-1);
+  return (l->off > r->off);
+}
+
+  //  Build and sort the keys of every NTHREADS'th run starting with the one given by arg
+
+static void *key_thread(void *arg)
+{ int64    psize = sizeof(void *);
+  int64    osize = sizeof(Overlap) - psize;
+  int      tbytes = (OS_tspace <= TRACE_XOVR ? sizeof(uint8) : sizeof(uint16));
+  int      r;
+
+  for (r = (int) ((int64) arg); r < 2*NTHREADS; r += NTHREADS)
+    { Ovl_Run *run = OS_krun + r;
+      Ovl_Key *key = OS_key + OS_kbeg[r];
+      Overlap *ovl;
+      int64    off, n;
+
+      n = 0;
+      for (off = 0; off < (int64) run->len; off += osize + ovl->path.tlen*tbytes)
+        { ovl = (Overlap *) (run->buf + off - psize);
+          key[n].aread = ovl->aread;
+          key[n].abpos = ovl->path.abpos;
+          if (OS_map)
+            key[n].bread = key[n].comp = 0;
+          else
+            { key[n].bread = ovl->bread;
+              key[n].comp  = COMP(ovl->flags);
+            }
+          key[n].off = off;
+          n += 1;
+        }
+      qsort(key,n,sizeof(Ovl_Key),KEY_ORDER);
+    }
+  return (NULL);
+}
+
+static inline int run_less(int r, int64 *rptr, int s)
+{ int c = key_cmp(OS_key + rptr[r], OS_key + rptr[s]);
+  return (c < 0 || (c == 0 && r < s));
+}
 
-#ifdef TEST_CONTAIN
-           if (novla > 1 || novlb > 1)
-             printf("\n%5d vs %5d:\n",ar,br);
-#endif
+  //  Sort and merge the runs of output o into file name
+
+static void write_runs(int o, char *name)
+{ int64    psize = sizeof(void *);
+  int64    osize = sizeof(Overlap) - psize;
+  int      tbytes = (OS_tspace <= TRACE_XOVR ? sizeof(uint8) : sizeof(uint16));
+  Ovl_Run *runs  = OS_run + 2*o*NTHREADS;
+  int      nrun  = 2*NTHREADS;
+  int64    novl, *rptr, *rend;
+  int     *heap, hsize;
+  FILE    *output;
+  int      r;
+
+  novl = 0;
+  for (r = 0; r < nrun; r++)
+    novl += runs[r].novl;
+
+  OS_key  = (Ovl_Key *) Malloc(sizeof(Ovl_Key)*(novl+1),"Allocating overlap keys");
+  OS_kbeg = (int64 *) Malloc(sizeof(int64)*3*(nrun+1),"Allocating overlap keys");
+  heap    = (int *) Malloc(sizeof(int)*(nrun+1),"Allocating overlap heap");
+  if (OS_key == NULL || OS_kbeg == NULL || heap == NULL)
+    Clean_Exit(1);
+  rptr = OS_kbeg + (nrun+1);
+  rend = rptr + (nrun+1);
 
-           if (novla > 1)
-             { if (novlb > 1)
-                 novla = novlb = Handle_Redundancies(amatch,novla,bmatch,align,work,tbuf);
-               else
-                 novla = Handle_Redundancies(amatch,novla,NULL,align,work,tbuf);
-             }
-           else if (novlb > 1)
-             novlb = Handle_Redundancies(bmatch,novlb,NULL,align,work,tbuf);
-
-           for (i = 0; i < novla; i++)
-             { ovla->path = amatch[i];
-               ovla->path.trace = tbuf->trace + (uint64) (ovla->path.trace);
-               if (small)
-                 Compress_TraceTo8(ovla,1);
-               if (Write_Overlap(ofile1,ovla,tbytes))
-                 { fprintf(stderr,"%s: Cannot write to %s too small?\n",SORT_PATH,Prog_Name);
-                   Clean_Exit(1);
-                 }
-             }
-           for (i = 0; i < novlb; i++)
-             { ovlb->path = bmatch[i];
-               ovlb->path.trace = tbuf->trace + (uint64) (ovlb->path.trace);
-               if (small)
-                 Compress_TraceTo8(ovlb,1);
-               if (Write_Overlap(ofile2,ovlb,tbytes))
-                 { fprintf(stderr,"%s: Cannot write to %s, too small?\n",SORT_PATH,Prog_Name);
-                   Clean_Exit(1);
-                 }
-             }
-           ahits += novla;
-           bhits += novlb;
-         }
-      }
+  OS_kbeg[0] = 0;
+  for (r = 0; r < nrun; r++)
+    OS_kbeg[r+1] = OS_kbeg[r] + runs[r].novl;
 
-  free(tbuf->trace);
-  free(bmatch);
-  free(amatch);
+  { pthread_t threads[NTHREADS];
+    int64     t;
+
+    OS_krun = runs;
+    for (t = 0; t < NTHREADS; t++)
+      pthread_create(threads+t,thread_attr(t),key_thread,(void *) t);
+    for (t = 0; t < NTHREADS; t++)
+      pthread_join(threads[t],NULL);
+  }
 
-  data->nfilt  = nfilt;
-  data->ncheck = ahits + bhits;
+  output = Fopen(name,"w");
+  if (output == NULL)
+    Clean_Exit(1);
+  if (fwrite(&novl,sizeof(int64),1,output) != 1 || fwrite(&OS_tspace,sizeof(int),1,output) != 1)
+    goto write_error;
+
+  //  Heap of the runs not yet exhausted, keyed on their next record
+
+  hsize = 0;
+  for (r = 0; r < nrun; r++)
+    { rptr[r] = OS_kbeg[r];
+      rend[r] = OS_kbeg[r+1];
+      if (rptr[r] < rend[r])
+        { int c, p;
+
+          c = ++hsize;
+          while (c > 1 && run_less(r,rptr,heap[p = c/2]))
+            { heap[c] = heap[p];
+              c = p;
+            }
+          heap[c] = r;
+        }
+    }
 
-  if (MR_two)
-    { rewind(ofile2);
-      fwrite(&bhits,sizeof(int64),1,ofile2);
-      fclose(ofile2);
+  while (hsize > 0)
+    { Overlap *ovl;
+      int64    span;
+      int      c, l;
+
+      r    = heap[1];
+      ovl  = (Overlap *) (runs[r].buf + OS_key[rptr[r]].off - psize);
+      span = osize + ovl->path.tlen*tbytes;
+      if (fwrite(((char *) ovl) + psize,1,span,output) != (size_t) span)
+        goto write_error;
+
+      if (++rptr[r] >= rend[r])
+        r = heap[hsize--];
+      c = 1;
+      while ((l = 2*c) <= hsize)
+        { if (l < hsize && run_less(heap[l+1],rptr,heap[l]))
+            l += 1;
+          if ( ! run_less(heap[l],rptr,r))
+            break;
+          heap[c] = heap[l];
+          c = l;
+        }
+      if (hsize > 0)
+        heap[c] = r;
     }
-  else
-    ahits += bhits;
 
-  rewind(ofile1);
-  fwrite(&ahits,sizeof(int64),1,ofile1);
-  fclose(ofile1);
+  if (fclose(output) != 0)
+    goto write_error;
 
-  return (NULL);
+  if (VERBOSE)
+    { printf("\n   Wrote ");
+      Print_Number(novl,0,stdout);
+      printf(" sorted overlaps to %s\n",name);
+      fflush(stdout);
+    }
+
+  for (r = 0; r < nrun; r++)
+    { free(runs[r].buf);
+      runs[r].buf = NULL;
+    }
+  free(heap);
+  free(OS_kbeg);
+  free(OS_key);
+  return;
+
+write_error:
+  fprintf(stderr,"%s: Cannot write to %s\n",Prog_Name,name);
+  Clean_Exit(1);
+}
+
+void Write_Sorted_Overlaps(char *aname, char *bname, int map)
+{ char *name;
+
+  OS_map = map;
+  name   = Strdup(Catenate(aname,".",bname,".las"),"Allocating file name");
+  if (name == NULL)
+    Clean_Exit(1);
+  write_runs(0,name);
+  free(name);
+  if (OS_two)
+    { name = Strdup(Catenate(bname,".",aname,".las"),"Allocating file name");
+      if (name == NULL)
+        Clean_Exit(1);
+      write_runs(1,name);
+      free(name);
+    }
 }
 
 
@@ -2333,6 +5822,15 @@ static void *report_thread(void *arg)
  *
  ********************************************************************************************/
 
+  //  The reverse hits found by the forward call in CANONICAL mode, held for the call on c(B)
+
+static void     *CS_aindex = NULL;   //  The index pair the hits are for (NULL if none are held)
+static void     *CS_bindex;
+static SeedPair *CS_hits;
+static int64     CS_nhits;
+static int64    *CS_off;             //  Start of each thread's hits in CS_hits
+static int64    *CS_kptr;            //  Each thread's histogram of apos bytes (for lex_sort)
+
 static char *NameBuffer(char *aname, char *bname)
 { static char *cat = NULL;
   static int   max = -1;
@@ -2363,23 +5861,76 @@ void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
   SeedPair *work1, *work2;
   int64     nhits;
   int64     nfilt, ncheck;
+  int64     mhpair, mhlost;
+
+  Kmer_Index *aindex, *bindex;
+  KmerPos    *asort, *bsort;
+  KmerPos    *atemp, *btemp;
+  int64       atot, btot;
+  int64       asize, bsize;
+  int         packed, bkeep;
+
+  int           nslab, slab;   //  SLABS mode: A-reads [sread[s],sread[s+1]) form slab s
+  int          *sread;
+  int64        *rcnt;
+  Diag_Bin     *counters;
+  Report_Chunk *chunks;
+
+  double        start;         //  Start time of a phase whose bandwidth is reported if VERBOSE
+
+  aindex  = (Kmer_Index *) vasort;
+  bindex  = (Kmer_Index *) vbsort;
+  asort   = (aindex == NULL) ? NULL : aindex->list;
+  bsort   = (bindex == NULL) ? NULL : bindex->list;
+
+  //  Packed lists are merged as such only if both are packed, otherwise a packed list is
+  //    expanded for the duration of the comparison (only when one block is too large to pack)
+
+  packed = (aindex != NULL && bindex != NULL && aindex->rshift > 0 && bindex->rshift > 0);
+  atemp  = btemp = NULL;
+  if ( ! packed)
+    { if (aindex != NULL && aindex->rshift > 0)
+        asort = atemp = unpack_kmers(aindex);
+      if (bindex != NULL && bindex->rshift > 0)
+        bsort = btemp = unpack_kmers(bindex);
+    }
+
+  //  The B-list is recycled as a hit vector unless it is the A-list, is mapped from a file,
+  //    is canonical and so needed again for the comparison with c(B), or may be needed for
+  //    several slabs
 
-  KmerPos  *asort, *bsort;
-  int64     atot, btot;
+  bkeep = (asort == bsort || (SLABS && MEM_LIMIT > 0)
+                          || (bindex != NULL && (bindex->msize > 0 || CANONICAL) && btemp == NULL));
 
-  asort = (KmerPos *) vasort;
-  bsort = (KmerPos *) vbsort;
+  asize = packed ? alen/2 : alen;     //  in units of sizeof(Double)
+  bsize = packed ? blen/2 : blen;
 
   atot = ablock->totlen;
   btot = bblock->totlen;
 
   MR_tspace = Trace_Spacing(aspec);
 
+  if (ORDERED)
+    { init_runs(comp);
+      OS_two    = (aname != bname && SYMMETRIC);
+      OS_tspace = MR_tspace;
+    }
+
+  nslab = 1;
+  slab  = 0;
+  sread = NULL;
+  rcnt  = NULL;
+  counters = NULL;
+  chunks   = NULL;
+  MG_rlo = 0;
+  MG_rhi = INT32_MAX;
+
   { int64 powr;
     int   i, nbyte;
 
     for (i = 0; i < NTHREADS; i++)
-      parmx[i].sptr = (int64 *) alloca(NTHREADS*BPOWR*sizeof(int64));
+      if ((parmx[i].sptr = numa_histogram(i)) == NULL)
+        parmx[i].sptr = (int64 *) alloca(NTHREADS*BPOWR*sizeof(int64));
 
     for (i = 0; i < 16; i++)
       pairsort[i] = 0;
@@ -2404,6 +5955,7 @@ void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
   }
 
   nfilt = ncheck = nhits = 0;
+  mhpair = mhlost = 0;
 
   if (VERBOSE)
     { if (comp)
@@ -2415,39 +5967,199 @@ void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
   if (alen == 0 || blen == 0)
     goto zerowork;
 
+  if (MINHASH > 0 && aindex->sketch != NULL && bindex->sketch != NULL)
+    { int64 ncand, npair;
+
+      ncand = mh_candidates(aindex->sketch,bindex->sketch);
+      if (VERBOSE)
+        { npair = ((int64) ablock->nreads) * bblock->nreads;
+          printf("\n   MinHash candidates = ");
+          Print_Number(ncand,0,stdout);
+          printf(" of ");
+          Print_Number(npair,0,stdout);
+          printf(" read pairs (%.1f%% pruned)\n",100.*(npair-ncand)/npair);
+          fflush(stdout);
+        }
+    }
+
   { int    i, j, p;
     uint64 c;
-    int    limit;
+    int    limit, climit;
+    int    fused = 0;
+    int64 *cgram;
+
+    MG_alist  = asort;
+    MG_blist  = bsort;
+    MG_self   = (aname == bname);
+    MG_comp   = comp;
+    MG_apk    = MG_bpk = NULL;
+    MG_chits  = NULL;
+    MG_breads = bblock->reads;
+
+    //  In CANONICAL mode the hits against c(B) may have been found by the call against B
+
+    if (CANONICAL && CS_aindex != NULL)
+      { if (comp && CS_aindex == aindex && CS_bindex == bindex)
+          { CS_aindex = NULL;
+            nhits = CS_nhits;
+            if (VERBOSE)
+              { printf("\n   Hit count = ");
+                Print_Number(nhits,0,stdout);
+                printf(" (found with the forward hits)\n");
+                fflush(stdout);
+              }
+            if (nhits == 0)
+              { huge_free(CS_hits);
+                goto zerowork;
+              }
 
-    MG_alist = asort;
-    MG_blist = bsort;
-    MG_self  = (aname == bname);
-    MG_comp  = comp;
+            khit = work2 = CS_hits;
+            if (INPLACE)
+              hhit = work1 = NULL;
+            else
+              { hhit = work1 = (SeedPair *) huge_alloc(sizeof(SeedPair)*(nhits+1),
+                                                   "Allocating daligner hit vectors");
+                if (hhit == NULL)
+                  Clean_Exit(1);
+                numa_touch(hhit,sizeof(SeedPair)*(nhits+1));
+              }
+            for (i = 0; i < NTHREADS; i++)
+              { parmm[i].nhits = CS_off[i];
+                memcpy(parmx[i].tptr,CS_kptr+i*BPOWR,sizeof(int64)*BPOWR);
+              }
+            goto merged;
+          }
+        huge_free(CS_hits);
+        CS_aindex = NULL;
+      }
 
-    parmm[0].abeg = parmm[0].bbeg = 0;
-    for (i = 1; i < NTHREADS; i++)
-      { p = (int) ((((int64) alen) * i) >> NSHIFT);
-        if (p > 0)
-          { c = asort[p-1].code;
-            while (asort[p].code == c)
-              p += 1;
+    if (packed)
+      { uint64 *apk = (uint64 *) asort;
+        uint64 *bpk = (uint64 *) bsort;
+
+        MG_apk     = apk;
+        MG_bpk     = bpk;
+        MG_arshift = aindex->rshift;
+        MG_armask  = aindex->rmask;
+        MG_brshift = bindex->rshift;
+        MG_brmask  = bindex->rmask;
+
+        parmm[0].abeg = parmm[0].bbeg = 0;
+        for (i = 1; i < NTHREADS; i++)
+          { p = (int) ((((int64) alen) * i) / NTHREADS);
+            if (p > 0)
+              { c = (PK_CODE(apk[p-1]) >> CANONICAL);
+                while ((PK_CODE(apk[p]) >> CANONICAL) == c)
+                  p += 1;
+              }
+            c = ((PK_CODE(apk[p]) >> CANONICAL) << CANONICAL);
+            parmm[i].abeg = parmm[i-1].aend = p;
+            parmm[i].bbeg = parmm[i-1].bend = find_packed_tuple(c,bpk,blen);
+          }
+      }
+    else
+      { parmm[0].abeg = parmm[0].bbeg = 0;
+        for (i = 1; i < NTHREADS; i++)
+          { p = (int) ((((int64) alen) * i) / NTHREADS);
+            if (p > 0)
+              { c = (asort[p-1].code >> CANONICAL);
+                while ((asort[p].code >> CANONICAL) == c)
+                  p += 1;
+              }
+            c = ((asort[p].code >> CANONICAL) << CANONICAL);
+            parmm[i].abeg = parmm[i-1].aend = p;
+            parmm[i].bbeg = parmm[i-1].bend = find_tuple(c,bsort,blen);
           }
-        parmm[i].abeg = parmm[i-1].aend = p;
-        parmm[i].bbeg = parmm[i-1].bend = find_tuple(asort[p].code,bsort,blen);
       }
     parmm[NTHREADS-1].aend = alen;
     parmm[NTHREADS-1].bend = blen;
 
+    //  In CANONICAL mode the reverse hits are counted (and histogrammed in cgram) along with
+    //    the forward ones so that they can be produced in the same pass if memory permits
+
+    cgram = NULL;
+    if (CANONICAL && ! comp)
+      { cgram = (int64 *) Malloc(sizeof(int64)*NTHREADS*MAXGRAM,"Allocating hit histograms");
+        if (cgram == NULL)
+          Clean_Exit(1);
+      }
     for (i = 0; i < NTHREADS; i++)
-      for (j = 0; j < MAXGRAM; j++)
-        parmm[i].hitgram[j] = 0;
+      { for (j = 0; j < MAXGRAM; j++)
+          parmm[i].hitgram[j] = 0;
+        if (cgram == NULL)
+          parmm[i].cgram = NULL;
+        else
+          { parmm[i].cgram = cgram + i*MAXGRAM;
+            for (j = 0; j < MAXGRAM; j++)
+              parmm[i].cgram[j] = 0;
+          }
+        parmm[i].chits  = 0;
+        parmm[i].climit = INT32_MAX;
+      }
+
+    //  In FUSED mode the hits are produced in the counting pass if they fit the memory left
+    //    once the hit vectors are allocated, with the cutoff the count would give them when
+    //    they do.  Otherwise the pass has served as the count and the merge follows as usual.
+
+    fused = (FUSED && ! CANONICAL);
+    if (fused)
+      { if (MEM_LIMIT > 0)
+          { FU_budget = (int64) (MEM_LIMIT - (sizeof_DB(ablock) + sizeof_DB(bblock)))
+                                                                         / sizeof(Double);
+            FU_budget = .98 * ((FU_budget - (asize + bsize)) / 2);
+            limit     = SLABS ? INT32_MAX : MAXGRAM;
+          }
+        else
+          { FU_budget = 0x7fffffffffffffffll;
+            limit     = INT32_MAX;
+          }
+        FU_used = 0;
+        FU_over = 0;
+        for (i = 0; i < NTHREADS; i++)
+          { parmm[i].fused  = 1;
+            parmm[i].hend   = 0;
+            parmm[i].nhits  = 0;
+            parmm[i].limit  = limit;
+            parmm[i].chunk  = NULL;
+            parmm[i].nchunk = parmm[i].mchunk = 0;
+            parmm[i].kptr   = parmx[i].tptr;
+            for (p = 0; p < BPOWR; p++)
+              parmm[i].kptr[p] = 0;
+          }
+        start = wall_clock();
+      }
 
     for (i = 0; i < NTHREADS; i++)
-      pthread_create(threads+i,NULL,count_thread,parmm+i);
+      pthread_create(threads+i,thread_attr(i),
+                     fused ? (packed ? merge_packed_thread : merge_thread)
+                           : CANONICAL ? count_canon_thread
+                                       : packed ? count_packed_thread : count_thread,parmm+i);
 
     for (i = 0; i < NTHREADS; i++)
       pthread_join(threads[i],NULL);
 
+    if (fused)
+      { if (FU_over)
+          { for (i = 0; i < NTHREADS; i++)
+              fuse_free(parmm+i);
+            fused = 0;
+            if (VERBOSE)
+              printf("\n   Hits exceed the one-pass budget, merging again");
+          }
+        else
+          { nhits = 0;
+            for (i = 0; i < NTHREADS; i++)
+              nhits += (parmm[i].nhits = parmm[i].hend);
+            if (VERBOSE)
+              print_bandwidth("Merge",16.*(asize + bsize + nhits),start);
+          }
+      }
+    for (i = 0; i < NTHREADS; i++)
+      { parmm[i].fused = 0;
+        if ( ! fused)
+          parmm[i].hend = 0x7fffffffffffffffll;
+      }
+
     if (VERBOSE)
       printf("\n");
     if (MEM_LIMIT > 0)
@@ -2461,54 +6173,182 @@ void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
             histo[j] += parmm[i].hitgram[j];
 
         avail = (int64) (MEM_LIMIT - (sizeof_DB(ablock) + sizeof_DB(bblock))) / sizeof(Double);
-        if (asort == bsort || avail > alen + 2*blen)
-          avail = (avail - alen) / 2;
+        if (INPLACE)
+          { if (asort == bsort)
+              avail = avail - asize;
+            else
+              avail = avail - (asize + bsize);
+          }
+        else if (bkeep && asort != bsort)
+          avail = (avail - (asize + bsize)) / 2;
+        else if (asort == bsort || avail > asize + 2*bsize)
+          avail = (avail - asize) / 2;
         else
-          avail = avail - (alen + blen);
+          avail = avail - (asize + bsize);
         avail *= .98;
 
-        tom = 0;
-        for (j = 0; j < MAXGRAM; j++)
-          { tom += j*histo[j];
+        //  In SLABS mode no k-mers are suppressed, rather if the hits do not fit then the
+        //    A-reads are partitioned into slabs whose hits do and each slab is processed in turn
+
+        if (SLABS)
+          { int64 ctom;
+
+            tom = ctom = 0;
+            for (i = 0; i < NTHREADS; i++)
+              { parmm[i].limit = INT32_MAX;
+                tom  += parmm[i].nhits;
+                ctom += parmm[i].chits;
+              }
+
             if (tom > avail)
-              break;
-          }
-        limit = j;
+              { int   nreads = ablock->nreads;
+                int64 x, t, smax;
+                int   r;
+
+                rcnt  = (int64 *) Malloc(sizeof(int64)*NTHREADS*nreads,"Allocating read counts");
+                sread = (int *) Malloc(sizeof(int)*(nreads+1),"Allocating slab boundaries");
+                if (rcnt == NULL || sread == NULL)
+                  Clean_Exit(1);
+                for (i = 0; i < NTHREADS; i++)
+                  { parmm[i].rcnt = rcnt + ((int64) i)*nreads;
+                    for (r = 0; r < nreads; r++)
+                      parmm[i].rcnt[r] = 0;
+                  }
 
-        if (limit <= 1)
-          { fprintf(stderr,"\nError: Insufficient ");
-            if (MEM_LIMIT == MEM_PHYSICAL)
-              fprintf(stderr," physical memory (%.1fGb), reduce block size\n",
-                             (1.*MEM_LIMIT)/0x40000000ll);
-            else
-              { fprintf(stderr," memory allocation (%.1fGb),",(1.*MEM_LIMIT)/0x40000000ll);
-                fprintf(stderr," reduce block size or increase allocation\n");
+                for (i = 0; i < NTHREADS; i++)
+                  pthread_create(threads+i,thread_attr(i),slab_count_thread,parmm+i);
+
+                for (i = 0; i < NTHREADS; i++)
+                  pthread_join(threads[i],NULL);
+
+                nslab = 0;
+                sread[0] = 0;
+                x = smax = 0;
+                for (r = 0; r < nreads; r++)
+                  { t = 0;
+                    for (i = 0; i < NTHREADS; i++)
+                      t += parmm[i].rcnt[r];
+                    if (x + t > avail && x > 0)
+                      { sread[++nslab] = r;
+                        if (x > smax)
+                          smax = x;
+                        x = 0;
+                      }
+                    x += t;
+                  }
+                sread[++nslab] = nreads;
+                if (x > smax)
+                  smax = x;
+
+                if (smax > avail)
+                  { fprintf(stderr,"\nWarning: The hits of a single read exceed the ");
+                    if (MEM_LIMIT == MEM_PHYSICAL)
+                      fprintf(stderr," physical memory (%.1fGb)\n",(1.*MEM_LIMIT)/0x40000000ll);
+                    else
+                      fprintf(stderr," memory allocation (%.1fGb)\n",(1.*MEM_LIMIT)/0x40000000ll);
+                    fflush(stderr);
+                  }
+                if (VERBOSE)
+                  { printf("   Processing the A-reads in %d slabs of at most ",nslab);
+                    Print_Number(smax,0,stdout);
+                    printf(" hits\n");
+                    fflush(stdout);
+                  }
+
+                for (i = 0; i < NTHREADS; i++)
+                  parmm[i].nhits = 0;
+                parmm[0].nhits = smax;    //  Hit vectors are sized for the largest slab
+                if (cgram != NULL)
+                  { free(cgram);
+                    cgram = NULL;
+                  }
               }
-            fflush(stderr);
-            Clean_Exit(1);
-          }
-        if (limit < 10)
-          { fprintf(stderr,"\nWarning: Sensitivity hampered by low ");
-            if (MEM_LIMIT == MEM_PHYSICAL)
-              fprintf(stderr," physical memory (%.1fGb), reduce block size\n",
-                             (1.*MEM_LIMIT)/0x40000000ll);
-            else
-              { fprintf(stderr," memory allocation (%.1fGb),",(1.*MEM_LIMIT)/0x40000000ll);
-                fprintf(stderr," reduce block size or increase allocation\n");
+            else if (cgram != NULL && (INPLACE ? tom + ctom > avail : 2*tom + ctom > 2*avail))
+              { free(cgram);
+                cgram = NULL;
               }
-            fflush(stderr);
-          }
-        if (VERBOSE)
-          { printf("   Capping mutual k-mer matches over %d (effectively -t%d)\n",
-                   limit,(int) sqrt(1.*limit));
-            fflush(stdout);
           }
 
-        for (i = 0; i < NTHREADS; i++)
-          { parmm[i].nhits = 0;
-            for (j = 1; j < limit; j++)
-              parmm[i].nhits += j * parmm[i].hitgram[j];
-            parmm[i].limit = limit;
+        else
+          { tom = 0;
+            for (j = 0; j < MAXGRAM; j++)
+              { tom += j*histo[j];
+                if (tom > avail)
+                  break;
+              }
+            limit = j;
+
+            if (limit <= 1)
+              { fprintf(stderr,"\nError: Insufficient ");
+                if (MEM_LIMIT == MEM_PHYSICAL)
+                  fprintf(stderr," physical memory (%.1fGb), reduce block size\n",
+                                 (1.*MEM_LIMIT)/0x40000000ll);
+                else
+                  { fprintf(stderr," memory allocation (%.1fGb),",(1.*MEM_LIMIT)/0x40000000ll);
+                    fprintf(stderr," reduce block size or increase allocation\n");
+                  }
+                fflush(stderr);
+                Clean_Exit(1);
+              }
+            if (limit < 10)
+              { fprintf(stderr,"\nWarning: Sensitivity hampered by low ");
+                if (MEM_LIMIT == MEM_PHYSICAL)
+                  fprintf(stderr," physical memory (%.1fGb), reduce block size\n",
+                                 (1.*MEM_LIMIT)/0x40000000ll);
+                else
+                  { fprintf(stderr," memory allocation (%.1fGb),",(1.*MEM_LIMIT)/0x40000000ll);
+                    fprintf(stderr," reduce block size or increase allocation\n");
+                  }
+                fflush(stderr);
+              }
+            if (VERBOSE)
+              { printf("   Capping mutual k-mer matches over %d (effectively -t%d)\n",
+                       limit,(int) sqrt(1.*limit));
+                fflush(stdout);
+              }
+
+            for (i = 0; i < NTHREADS; i++)
+              { parmm[i].nhits = 0;
+                for (j = 1; j < limit; j++)
+                  parmm[i].nhits += j * parmm[i].hitgram[j];
+                parmm[i].limit = limit;
+              }
+
+            //  The reverse hits get the cutoff the call on c(B) would give them, and are produced
+            //    now only if they fit in memory along with the forward hits
+
+            if (cgram != NULL)
+              { int64 ctom;
+
+                for (j = 0; j < MAXGRAM; j++)
+                  histo[j] = 0;
+                for (i = 0; i < NTHREADS; i++)
+                  for (j = 0; j < MAXGRAM; j++)
+                    histo[j] += parmm[i].cgram[j];
+
+                ctom = 0;
+                for (j = 0; j < MAXGRAM; j++)
+                  { ctom += j*histo[j];
+                    if (ctom > avail)
+                      break;
+                  }
+                climit = j;
+
+                tom = ctom = 0;
+                for (i = 0; i < NTHREADS; i++)
+                  { parmm[i].chits = 0;
+                    for (j = 1; j < climit; j++)
+                      parmm[i].chits += j * parmm[i].cgram[j];
+                    parmm[i].climit = climit;
+                    tom  += parmm[i].nhits;
+                    ctom += parmm[i].chits;
+                  }
+
+                if (climit <= 1 || (INPLACE ? tom + ctom > avail : 2*tom + ctom > 2*avail))
+                  { free(cgram);
+                    cgram = NULL;
+                  }
+              }
           }
       }
     else
@@ -2519,53 +6359,190 @@ void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
     for (i = 1; i < NTHREADS; i++)
       parmm[i].nhits = nhits += parmm[i].nhits;
 
+    if (cgram != NULL)
+      { free(cgram);
+        CS_nhits = parmm[0].chits;
+        for (i = 1; i < NTHREADS; i++)
+          parmm[i].chits = CS_nhits += parmm[i].chits;
+        for (i = NTHREADS-1; i > 0; i--)
+          parmm[i].chits = parmm[i-1].chits;
+        parmm[0].chits = 0;
+
+        if (CS_off == NULL)
+          { CS_off  = (int64 *) Malloc(sizeof(int64)*MAXTHREADS,"Allocating hit offsets");
+            CS_kptr = (int64 *) Malloc(sizeof(int64)*MAXTHREADS*BPOWR,"Allocating hit offsets");
+          }
+        CS_hits = (SeedPair *) huge_alloc(sizeof(SeedPair)*(CS_nhits+1),
+                                      "Allocating daligner hit vectors");
+        if (CS_off == NULL || CS_kptr == NULL || CS_hits == NULL)
+          Clean_Exit(1);
+        numa_touch(CS_hits,sizeof(SeedPair)*(CS_nhits+1));
+        for (i = 0; i < NTHREADS; i++)
+          { CS_off[i] = parmm[i].chits;
+            parmm[i].ckptr = CS_kptr + i*BPOWR;
+            for (p = 0; p < BPOWR; p++)
+              parmm[i].ckptr[p] = 0;
+          }
+        MG_chits = CS_hits;
+      }
+
     if (VERBOSE)
       { printf("   Hit count = ");
         Print_Number(nhits,0,stdout);
-        if (asort == bsort || nhits >= blen)
+        if (MG_chits != NULL)
+          { printf("\n   Reverse hit count = ");
+            Print_Number(CS_nhits,0,stdout);
+          }
+        if (INPLACE)
+          printf("\n   Highwater of %.2fGb space\n",
+                       (1. * (asize + (asort == bsort ? 0 : bsize) + nhits)) / 67108864);
+        else if (asort == bsort || nhits >= bsize)
           printf("\n   Highwater of %.2fGb space\n",
-                       (1. * (alen + 2*nhits)) / 67108864);
+                       (1. * (asize + 2*nhits)) / 67108864);
         else
           printf("\n   Highwater of %.2fGb space\n",
-                       (1. * (alen + blen + nhits)) / 67108864);
+                       (1. * (asize + bsize + nhits)) / 67108864);
         fflush(stdout);
       }
 
-    if (nhits == 0)
+    if (nhits == 0 && MG_chits == NULL)
       goto zerowork;
 
-    if (asort == bsort)
-      hhit = work1 = (SeedPair *) Malloc(sizeof(SeedPair)*(nhits+1),
-                                         "Allocating daligner hit vectors");
+    if (INPLACE)
+      hhit = work1 = NULL;
+    else if (bkeep)
+      { hhit = work1 = (SeedPair *) huge_alloc(sizeof(SeedPair)*(nhits+1),
+                                           "Allocating daligner hit vectors");
+        numa_touch(hhit,sizeof(SeedPair)*(nhits+1));
+      }
     else
-      { if (nhits >= blen)
-          bsort = (KmerPos *) Realloc(bsort,sizeof(SeedPair)*(nhits+1),
+      { if (nhits >= bsize)
+          bsort = (KmerPos *) huge_realloc(bsort,sizeof(SeedPair)*(nhits+1),
                                        "Reallocating daligner sort vectors");
         hhit = work1 = (SeedPair *) bsort;
+        if (btemp == NULL)
+          bindex->list = NULL;    //  B-list is recycled as a hit vector and freed below
+        else
+          btemp = NULL;
       }
-    khit = work2 = (SeedPair *) Malloc(sizeof(SeedPair)*(nhits+1),
+    khit = work2 = (SeedPair *) huge_alloc(sizeof(SeedPair)*(nhits+1),
                                         "Allocating daligner hit vectors");
-    if (hhit == NULL || khit == NULL || bsort == NULL)
+    if ((hhit == NULL && ! INPLACE) || khit == NULL || bsort == NULL)
       Clean_Exit(1);
+    numa_touch(khit,sizeof(SeedPair)*(nhits+1));
 
     MG_blist = bsort;
+    MG_bpk   = packed ? (uint64 *) bsort : NULL;
     MG_hits  = khit;
 
     for (i = NTHREADS-1; i > 0; i--)
       parmm[i].nhits = parmm[i-1].nhits;
     parmm[0].nhits = 0;
 
-    for (i = 0; i < NTHREADS; i++)
-      { parmm[i].kptr = parmx[i].tptr;
-        for (p = 0; p < BPOWR; p++)
-          parmm[i].kptr[p] = 0;
+  next_slab:
+    if (nslab > 1)
+      { int64 x;
+        int   r;
+
+        MG_rlo = sread[slab];
+        MG_rhi = sread[slab+1];
+        MG_hits = khit = work2;
+        hhit = work1;
+
+        x = 0;
+        for (i = 0; i < NTHREADS; i++)
+          { parmm[i].nhits = x;
+            for (r = MG_rlo; r < MG_rhi; r++)
+              x += parmm[i].rcnt[r];
+          }
+        nhits = x;
+
+        if (VERBOSE)
+          { printf("\n   Slab %d: A-reads %d to %d, ",slab+1,MG_rlo+1,MG_rhi);
+            Print_Number(nhits,0,stdout);
+            printf(" hits\n");
+            fflush(stdout);
+          }
       }
 
-    for (i = 0; i < NTHREADS; i++)
-      pthread_create(threads+i,NULL,merge_thread,parmm+i);
+    if (fused)
+      { for (i = 0; i < NTHREADS; i++)
+          pthread_create(threads+i,thread_attr(i),fuse_copy_thread,parmm+i);
 
-    for (i = 0; i < NTHREADS; i++)
-      pthread_join(threads[i],NULL);
+        for (i = 0; i < NTHREADS; i++)
+          pthread_join(threads[i],NULL);
+      }
+    else
+      { for (i = 0; i < NTHREADS; i++)
+          { parmm[i].kptr = parmx[i].tptr;
+            for (p = 0; p < BPOWR; p++)
+              parmm[i].kptr[p] = 0;
+          }
+
+        start = wall_clock();
+
+        for (i = 0; i < NTHREADS; i++)
+          pthread_create(threads+i,thread_attr(i),CANONICAL ? merge_canon_thread :
+                                        packed ? merge_packed_thread : merge_thread,parmm+i);
+
+        for (i = 0; i < NTHREADS; i++)
+          pthread_join(threads[i],NULL);
+
+        if (VERBOSE)
+          print_bandwidth("Merge",16.*(asize + bsize + nhits),start);
+      }
+
+    if (MG_chits != NULL)
+      { CS_aindex = aindex;
+        CS_bindex = bindex;
+      }
+
+    if (INPLACE && ! bkeep)
+      { huge_free(bsort);          //  Hits are sorted in place, B-list no longer needed
+        if (btemp == NULL)
+          bindex->list = NULL;
+        else
+          btemp = NULL;
+      }
+
+    if (nhits == 0)
+      { huge_free(work2);
+        huge_free(work1);
+        goto zerowork;
+      }
+
+  merged:
+    if (MH_cbeg != NULL && ! MHAUDIT)
+      { int64  off[NTHREADS+1];
+        int64 *kptr[NTHREADS];
+        int64  x;
+
+        for (i = 0; i < NTHREADS; i++)
+          { off[i]  = parmm[i].nhits;
+            kptr[i] = parmx[i].tptr;
+          }
+        off[NTHREADS] = x = nhits;
+
+        nhits = prune_hits(khit,off,kptr);
+
+        for (i = 0; i < NTHREADS; i++)
+          parmm[i].nhits = off[i];
+
+        if (VERBOSE)
+          { printf("   MinHash pruned ");
+            Print_Number(x-nhits,0,stdout);
+            printf(" of ");
+            Print_Number(x,0,stdout);
+            printf(" hits\n");
+            fflush(stdout);
+          }
+
+        if (nhits == 0 && nslab == 1)
+          { huge_free(work2);
+            huge_free(work1);
+            goto zerowork;
+          }
+      }
 
 #ifdef TEST_PAIRS
     printf("\nSETUP SORT:\n");
@@ -2587,7 +6564,29 @@ void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
     parmx[NTHREADS-1].beg = x;
     parmx[NTHREADS-1].end = nhits;
 
-    khit = (SeedPair *) lex_sort(pairsort,(Double *) khit,(Double *) hhit,parmx);
+    start = wall_clock();
+
+    if (INPLACE)
+
+      //  Pairs with the same a-read, b-read, and a-position come from a single A-entry and
+      //    were emitted in order of increasing b-position, i.e. decreasing diagonal.
+
+      { static int tie[4]  = { 3, 2, 1, 0 };
+        static int flip[4] = { 0x7f, 0xff, 0xff, 0xff };
+        Digit digit[20];
+        int   ndig;
+
+        ndig = msd_digits(digit,pairsort,4,tie,flip);
+        msd_sort(digit,ndig,(uint64 *) khit,2,nhits);
+      }
+    else
+      khit = (SeedPair *) lex_sort(pairsort,(Double *) khit,(Double *) hhit,parmx);
+
+    if (VERBOSE)
+      { for (x = i = 0; i < 16; i++)
+          x += pairsort[i];
+        print_bandwidth("Hit sort",32.*x*nhits,start);
+      }
 
     khit[nhits].aread = 0x7fffffff;
     khit[nhits].bread = 0x7fffffff;
@@ -2606,17 +6605,89 @@ void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
   { int    i, w;
     int64  p;
     int    d;
-    int   *counters;
 
-    MR_ablock = ablock;
-    MR_bblock = bblock;
-    MR_hits   = khit;
-    MR_two    = ! MG_self && SYMMETRIC;
-    MR_spec   = aspec;
+    //  The overlap files, diagonal counters, and chunk vector are set up with the first slab
+
+    if (slab == 0)
+      { MR_ablock = ablock;
+        MR_bblock = bblock;
+        MR_two    = ! MG_self && SYMMETRIC;
+        MR_spec   = aspec;
+
+        w = ((ablock->maxlen >> Binshift) - ((-bblock->maxlen) >> Binshift)) + 3;
+        counters = (Diag_Bin *) Malloc(NTHREADS*w*sizeof(Diag_Bin),"Allocating diagonal buckets");
+        if (counters == NULL)
+          Clean_Exit(1);
+
+        fname = NameBuffer(aname,bname);
+
+        memset(counters,0,NTHREADS*w*sizeof(Diag_Bin));
+        for (i = 0; i < NTHREADS; i++)
+          { parmr[i].band = counters + i*w + 1 - ((-bblock->maxlen) >> Binshift);
+            parmr[i].work = New_Work_Data();
+
+            if (ORDERED)
+              { Ovl_Run *run1 = OS_run + comp*NTHREADS + i;
+                Ovl_Run *run2 = run1 + 2*NTHREADS;
+
+                parmr[i].ofile1 = open_memstream(&(run1->buf),&(run1->len));
+                if (MR_two)
+                  parmr[i].ofile2 = open_memstream(&(run2->buf),&(run2->len));
+                else
+                  parmr[i].ofile2 = parmr[i].ofile1;
+                if (parmr[i].ofile1 == NULL || parmr[i].ofile2 == NULL)
+                  { fprintf(stderr,"%s: Cannot open memory stream for overlaps\n",Prog_Name);
+                    Clean_Exit(1);
+                  }
+                parmr[i].ahits = parmr[i].bhits = 0;
+                parmr[i].nfilt = parmr[i].ncheck = 0;
+                parmr[i].mhpair = parmr[i].mhlost = 0;
+                pthread_mutex_init(&(parmr[i].lock),NULL);
+                continue;
+              }
+
+            sprintf(fname,"%s/%s.%s.%c%d.las",SORT_PATH,aname,bname,(comp?'C':'N'),i+1);
+            parmr[i].ofile1 = Fopen(fname,"w");
+            if (parmr[i].ofile1 == NULL)
+              Clean_Exit(1);
+            if (MG_self)
+              parmr[i].ofile2 = parmr[i].ofile1;
+            else if (SYMMETRIC)
+              { sprintf(fname,"%s/%s.%s.%c%d.las",SORT_PATH,bname,aname,(comp?'C':'N'),i+1);
+                parmr[i].ofile2 = Fopen(fname,"w");
+                if (parmr[i].ofile2 == NULL)
+                  Clean_Exit(1);
+              }
+
+            parmr[i].ahits = parmr[i].bhits = 0;
+            parmr[i].nfilt = parmr[i].ncheck = 0;
+            parmr[i].mhpair = parmr[i].mhlost = 0;
+            fwrite(&(parmr[i].ahits),sizeof(int64),1,parmr[i].ofile1);
+            fwrite(&MR_tspace,sizeof(int),1,parmr[i].ofile1);
+            fflush(parmr[i].ofile1);
+            if (MR_two)
+              { fwrite(&(parmr[i].bhits),sizeof(int64),1,parmr[i].ofile2);
+                fwrite(&MR_tspace,sizeof(int),1,parmr[i].ofile2);
+                fflush(parmr[i].ofile2);
+              }
+            parmr[i].off1 = parmr[i].off2 = sizeof(int64) + sizeof(int);
+            pthread_mutex_init(&(parmr[i].lock),NULL);
+          }
+
+        if ( ! ORDERED)
+          write_start();
+
+        chunks = (Report_Chunk *) Malloc(sizeof(Report_Chunk)*NTHREADS*REPORT_CHUNKS,
+                                         "Allocating report chunks");
+        if (chunks == NULL)
+          Clean_Exit(1);
+      }
+
+    MR_hits = khit;
 
     parmr[0].beg = 0;
     for (i = 1; i < NTHREADS; i++)
-      { p = (nhits * i) >> NSHIFT;
+      { p = (nhits * i) / NTHREADS;
         if (p > 0)
           { d = khit[p-1].bread;
             while ((khit[p].bread) == d)
@@ -2626,37 +6697,38 @@ void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
       }
     parmr[NTHREADS-1].end = nhits;
 
-    w = ((ablock->maxlen >> Binshift) - ((-bblock->maxlen) >> Binshift)) + 1;
-    counters = (int *) Malloc(NTHREADS*3*w*sizeof(int),"Allocating diagonal buckets");
-    if (counters == NULL)
-      Clean_Exit(1);
+    //  Split each segment into REPORT_CHUNKS chunks at read pair boundaries
 
-    fname = NameBuffer(aname,bname);
+    { Double *hitd = (Double *) khit;
+      int64   q, x;
+      int     c, n;
 
-    for (i = 0; i < 3*w*NTHREADS; i++)
-      counters[i] = 0;
-    for (i = 0; i < NTHREADS; i++)
-      { if (i == 0)
-          parmr[i].score = counters - ((-bblock->maxlen) >> Binshift);
-        else
-          parmr[i].score = parmr[i-1].lasta + w;
-        parmr[i].lastp = parmr[i].score + w;
-        parmr[i].lasta = parmr[i].lastp + w;
-        parmr[i].work  = New_Work_Data();
-
-        sprintf(fname,"%s/%s.%s.%c%d.las",SORT_PATH,aname,bname,(comp?'C':'N'),i+1);
-        parmr[i].ofile1 = Fopen(fname,"w");
-        if (parmr[i].ofile1 == NULL)
-          Clean_Exit(1);
-        if (MG_self)
-          parmr[i].ofile2 = parmr[i].ofile1;
-        else if (SYMMETRIC)
-          { sprintf(fname,"%s/%s.%s.%c%d.las",SORT_PATH,bname,aname,(comp?'C':'N'),i+1);
-            parmr[i].ofile2 = Fopen(fname,"w");
-            if (parmr[i].ofile2 == NULL)
-              Clean_Exit(1);
-          }
-      }
+      n = 0;
+      for (i = 0; i < NTHREADS; i++)
+        { parmr[i].tnum   = i;
+          parmr[i].commit = n;
+          q = parmr[i].beg;
+          for (c = 1; c <= REPORT_CHUNKS && q < parmr[i].end; c++)
+            { x = parmr[i].beg + ((parmr[i].end - parmr[i].beg) * c) / REPORT_CHUNKS;
+              if (x <= q)
+                continue;
+              while (x < parmr[i].end && hitd[x].p2 == hitd[x-1].p2)
+                x += 1;
+              chunks[n].beg   = q;
+              chunks[n].end   = x;
+              chunks[n].owner = i;
+              chunks[n].done  = 0;
+              chunks[n].buf1  = chunks[n].buf2 = NULL;
+              n += 1;
+              q  = x;
+            }
+          parmr[i].cend  = n;
+          parmr[i].claim = (((uint64) parmr[i].commit) << 32) | n;
+        }
+    }
+
+    MR_parm  = parmr;
+    MR_chunk = chunks;
 
 #ifdef NOTHREAD
 
@@ -2666,17 +6738,64 @@ void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
 #else
 
     for (i = 0; i < NTHREADS; i++)
-      pthread_create(threads+i,NULL,report_thread,parmr+i);
+      pthread_create(threads+i,thread_attr(i),report_thread,parmr+i);
 
     for (i = 0; i < NTHREADS; i++)
       pthread_join(threads[i],NULL);
 
 #endif
 
+    if (++slab < nslab)
+      goto next_slab;
+
+    if ( ! ORDERED)
+      { write_finish();
+        if (VERBOSE)
+          { printf("   Overlap writer: %.2fGb in %.2fs",WR_bytes/(double) 0x40000000ll,WR_busy);
+            if (WR_busy > 0.)
+              printf(" = %.2fGb/s",(WR_bytes/(double) 0x40000000ll)/WR_busy);
+            printf(", report threads stalled %.2fs\n",WR_stall);
+            fflush(stdout);
+          }
+      }
+
+    for (i = 0; i < NTHREADS; i++)
+      { if (ORDERED)
+          { OS_run[comp*NTHREADS+i].novl = parmr[i].ahits;
+            if (MR_two)
+              { OS_run[(2+comp)*NTHREADS+i].novl = parmr[i].bhits;
+                fclose(parmr[i].ofile2);
+              }
+            else
+              OS_run[comp*NTHREADS+i].novl += parmr[i].bhits;
+            fclose(parmr[i].ofile1);
+            pthread_mutex_destroy(&(parmr[i].lock));
+            continue;
+          }
+        if (MR_two)
+          { if (pwrite(fileno(parmr[i].ofile2),&(parmr[i].bhits),sizeof(int64),0) < 0)
+              { fprintf(stderr,"%s: Cannot write to %s, too small?\n",Prog_Name,SORT_PATH);
+                Clean_Exit(1);
+              }
+            fclose(parmr[i].ofile2);
+          }
+        else
+          parmr[i].ahits += parmr[i].bhits;
+        if (pwrite(fileno(parmr[i].ofile1),&(parmr[i].ahits),sizeof(int64),0) < 0)
+          { fprintf(stderr,"%s: Cannot write to %s, too small?\n",Prog_Name,SORT_PATH);
+            Clean_Exit(1);
+          }
+        fclose(parmr[i].ofile1);
+        pthread_mutex_destroy(&(parmr[i].lock));
+      }
+    free(chunks);
+
     if (VERBOSE)
       for (i = 0; i < NTHREADS; i++)
         { nfilt  += parmr[i].nfilt;
           ncheck += parmr[i].ncheck;
+          mhpair += parmr[i].mhpair;
+          mhlost += parmr[i].mhlost;
         }
 
     for (i = 0; i < NTHREADS; i++)
@@ -2684,8 +6803,10 @@ void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
     free(counters);
   }
 
-  free(work2);
-  free(work1);
+  huge_free(work2);
+  huge_free(work1);
+  free(sread);
+  free(rcnt);
   goto epilogue;
 
 zerowork:
@@ -2695,6 +6816,8 @@ zerowork:
     fname = NameBuffer(aname,bname);
 
     nhits  = 0;
+    if (ORDERED)
+      goto epilogue;
     for (i = 0; i < NTHREADS; i++)
       { sprintf(fname,"%s/%s.%s.%c%d.las",SORT_PATH,aname,bname,(comp?'C':'N'),i+1);
         ofile = Fopen(fname,"w");
@@ -2712,6 +6835,8 @@ zerowork:
   }
 
 epilogue:
+  huge_free(atemp);
+  huge_free(btemp);
 
   if (VERBOSE)
     { int width;
@@ -2729,6 +6854,16 @@ epilogue:
       printf(" seed hits (%e of matrix)\n     ",(1.*nfilt/atot)/btot);
       Print_Number(ncheck,width,stdout);
       printf(" confirmed hits (%e of matrix)\n",(1.*ncheck/atot)/btot);
+      if (MHAUDIT && MH_cbeg != NULL)
+        { printf("     ");
+          Print_Number(mhlost,width,stdout);
+          printf(" of ");
+          Print_Number(mhpair,0,stdout);
+          printf(" read pairs with overlaps would be pruned by -j%d (%.2f%%)\n",
+                 MINHASH,mhpair > 0 ? (100.*mhlost)/mhpair : 0.);
+        }
       fflush(stdout);
     }
+
+  mh_free();
 }
@@ -15,24 +15,65 @@
 #include "align.h"
 
 extern int    BIASED;
+extern int    WINDOW;
+extern int    INPLACE;
+extern int    CANONICAL;
+extern int    SLABS;
+extern int    FUSED;
+extern int    KFREQ;
+extern int    MINHASH;
+extern int    MHAUDIT;
+extern int    ORDERED;
+extern int    NUMA;
+extern int    HUGEPAGE;
 extern int    VERBOSE;
 extern int    MINOVER;
 extern int    HGAP_MIN;
 extern int    SYMMETRIC;
 extern int    IDENTITY;
+extern int    NSEED;
+extern char  *SEED[];
 extern char  *SORT_PATH;
 
 extern uint64 MEM_LIMIT;
 extern uint64 MEM_PHYSICAL;
 
+#define MH_SIZE  128   //  Reads are sketched by the MH_SIZE least hashes of their k-mers (-j)
+
+  //  If NSEED > 0 then rather than contiguous k-mers the reads are seeded with the NSEED
+  //    spaced seed patterns SEED[0..NSEED) (-p), each a 0/1 string of length at most 32 that
+  //    begins and ends with a 1, and all with the same number of 1's, the kmer given to
+  //    Set_Filter_Params.
+
+#define MAX_SEEDS  4
+
 int Set_Filter_Params(int kmer, int binshift, int suppress, int hitmin, int nthreads); 
 
-void *Sort_Kmers(DAZZ_DB *block, int *len);
+  //  Change the number of threads, which cannot exceed that first given to Set_Filter_Params
+
+int Set_Filter_Threads(int nthreads);
+
+  //  If comp then the index is of the reverse complements of the block's reads, generated
+  //    from the forward sequence, and Match_Filter likewise takes the forward B-block
+
+void *Sort_Kmers(DAZZ_DB *block, int comp, int *len);
+void  Free_Kmer_Index(void *index);
+
+  //  Persistent k-mer indices: a .kidx (.ckidx if comp) sidecar file for a DB block, or if dir
+  //    is not NULL a scratch file in dir that is removed when loaded
+
+void *Load_Kmer_Index(DAZZ_DB *block, int comp, char *dir, int *len);
+int   Save_Kmer_Index(DAZZ_DB *block, int comp, char *dir, void *index);
 
 void Match_Filter(char *aname, DAZZ_DB *ablock, char *bname, DAZZ_DB *bblock,
                   void *atable, int alen, void *btable, int blen,
                   int comp, Align_Spec *asettings);
 
+  //  If ORDERED, Match_Filter keeps the overlaps it finds in memory and once both orientations
+  //    of a comparison are done they are written sorted to aname.bname.las (and bname.aname.las)
+
+void Write_Sorted_Overlaps(char *aname, char *bname, int map);
+
 void Clean_Exit(int val);
 
 #endif
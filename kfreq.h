@@ -0,0 +1,55 @@
+/*******************************************************************************************
+ *
+ *  DB-wide k-mer frequency table (.kfreq) shared by DBkcount, that builds it, and daligner,
+ *    that suppresses the k-mers it deems too frequent.
+ *
+ *  The table has a 16-bit saturating counter for every slot.  The slot of a k-mer is that
+ *    of the lesser of its code and the code of its reverse complement, so a k-mer and its
+ *    complement are counted together.  If 4^k is at most 2^KFREQ_BITS then the slot is the
+ *    code itself and the counts are exact, otherwise codes are hashed to KFREQ_BITS bits
+ *    and a count is an upper bound on the true count.
+ *
+ ********************************************************************************************/
+
+#ifndef _KFREQ
+
+#define _KFREQ
+
+#include "DB.h"
+
+#define KFREQ_MAGIC    "DAZZKFRQ"
+#define KFREQ_VERSION  1
+#define KFREQ_BITS     28
+#define KFREQ_MAX      0xffff
+
+typedef struct
+  { char   magic[8];
+    int    version;
+    int    kmer;       //  k-mer length
+    int    tbits;      //  The table has 2^tbits 16-bit counters following the header
+    int    nreads;     //  # of reads counted (in the trimmed DB)
+    int64  totlen;     //  # of bases counted
+    int64  nkmers;     //  # of k-mers counted
+  } Kfreq_Header;
+
+  //  The .kfreq file of the DB whose path (as in DAZZ_DB.path) is path
+
+#define KFREQ_NAME(path)  Catenate(path,"","",".kfreq")
+
+static inline int Kfreq_Bits(int kmer)
+{ if (2*kmer < KFREQ_BITS)
+    return (2*kmer);
+  return (KFREQ_BITS);
+}
+
+  //  Slot of the k-mer with code c and reverse complement code r for a table of 2^tbits
+
+static inline uint64 Kfreq_Slot(uint64 c, uint64 r, int kmer, int tbits)
+{ if (r < c)
+    c = r;
+  if (2*kmer <= tbits)
+    return (c);
+  return ((c * 0x9e3779b97f4a7c15llu) >> (64-tbits));
+}
+
+#endif // _KFREQ